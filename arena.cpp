@@ -0,0 +1,97 @@
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <algorithm>
+#include "arena.h"
+
+namespace {
+	// zero initialized and without a constructor, so operator new can count into it from the very first
+	// allocation of a thread on
+	thread_local unsigned long long allocations;
+	// off unless asked for, then operator new costs a relaxed load on top of malloc
+	std::atomic<bool> countAllocations(false);
+}
+
+void* operator new(size_t size) {
+	if (countAllocations.load(std::memory_order_relaxed))
+		allocations++;
+	void* p = std::malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	std::free(p);
+}
+
+void count_heap_allocations(bool enable) {
+	countAllocations.store(enable, std::memory_order_relaxed);
+}
+
+unsigned long long heap_allocations() {
+	return allocations;
+}
+
+FrameArena::FrameArena(size_t size) : data_(new char[size]), size_(size), used_(0), overflow_(), overflowBytes_(0), high_(0), peak_(0) {
+}
+
+FrameArena::~FrameArena() {
+	for (int i = 0; i < (int)overflow_.size(); i++)
+		delete[] overflow_[i];
+	delete[] data_;
+}
+
+// align has to be a power of two no larger than alignof(std::max_align_t), which operator new guarantees
+// for the blocks
+void* FrameArena::allocate(size_t bytes, size_t align) {
+	size_t offset = (used_ + align - 1) & ~(align - 1);
+	if (offset + bytes <= size_) {
+		used_ = offset + bytes;
+		high_ = std::max(high_, used());
+		return data_ + offset;
+	}
+	char* block = new char[bytes ? bytes : 1];
+	overflow_.push_back(block);
+	overflowBytes_ += bytes;
+	high_ = std::max(high_, used());
+	return block;
+}
+
+// releases everything allocated since the last reset; only after a frame that overflowed does it touch
+// the heap, to trade the extra blocks for one that holds such a frame whole
+void FrameArena::reset() {
+	size_t total = high_;
+	peak_ = std::max(peak_, total);
+	if (!overflow_.empty()) {
+		for (int i = 0; i < (int)overflow_.size(); i++)
+			delete[] overflow_[i];
+		overflow_.clear();
+		delete[] data_;
+		size_ = std::max(size_ * 2, total + total / 2);
+		data_ = new char[size_];
+	}
+	used_ = 0;
+	overflowBytes_ = 0;
+	high_ = 0;
+}
+
+FrameArena& FrameArena::local() {
+	static thread_local FrameArena arena;
+	return arena;
+}
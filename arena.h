@@ -0,0 +1,50 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+// Bump allocator for everything that lives no longer than a frame: projected vertices, visibility lists,
+// instance states and the like are carved out of one block and all of them are released at once by reset(),
+// which only rewinds an offset. A frame that outgrows the block spills into extra blocks; reset() then
+// replaces all of them with a single block large enough for that frame, so after the first few frames
+// nothing is allocated any more. Nothing is constructed or destroyed, only plain data belongs in here.
+// Every thread has its own arena, see local().
+class FrameArena {
+private:
+	char* data_;
+	size_t size_;
+	size_t used_;
+	std::vector<char*> overflow_; // blocks taken when data_ ran out during this frame
+	size_t overflowBytes_;
+	size_t high_;                 // most bytes this frame has held at once, rewinds notwithstanding
+	size_t peak_;                 // most bytes a frame has asked for so far
+
+	FrameArena(const FrameArena&);
+	FrameArena& operator=(const FrameArena&);
+public:
+	FrameArena(size_t size = 1 << 16);
+	~FrameArena();
+	void* allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+	template <class T> T* allocate(size_t count) {
+		return (T*)allocate(count * sizeof(T), alignof(T));
+	}
+	void reset();
+	// scratch that only lives as long as a call: allocations after mark() are handed back by rewind(mark)
+	size_t mark() const { return used_; }
+	void rewind(size_t mark) { used_ = std::min(used_, mark); }
+	size_t used() const { return used_ + overflowBytes_; }
+	size_t capacity() const { return size_; }
+	size_t peak() const { return peak_; }
+
+	static FrameArena& local();
+};
+
+// heap allocations made so far by the calling thread through operator new, which arena.cpp replaces to
+// count them; the difference across a stretch of code tells whether it touched the heap. Counting is off
+// until count_heap_allocations(true), before which heap_allocations() stays 0
+void count_heap_allocations(bool enable);
+unsigned long long heap_allocations();
+
+#endif //__ARENA_H__
@@ -0,0 +1,314 @@
+#include <deque>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <functional>
+#include <condition_variable>
+#include <sys/stat.h>
+#include "assets.h"
+#include "model.h"
+#include "blocktexture.h"
+
+// Fixed set of worker threads draining a FIFO of load jobs. Pending jobs are still run on
+// destruction so that every future handed out by the cache gets resolved.
+class AssetPool {
+private:
+	std::vector<std::thread> workers_;
+	std::deque<std::function<void()> > jobs_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	bool stop_;
+
+	void work() {
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				wake_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+				if (jobs_.empty()) return;
+				job = jobs_.front();
+				jobs_.pop_front();
+			}
+			job();
+		}
+	}
+public:
+	AssetPool(int nthreads) : stop_(false) {
+		for (int i = 0; i < nthreads; i++)
+			workers_.push_back(std::thread(&AssetPool::work, this));
+	}
+
+	~AssetPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+		for (size_t i = 0; i < workers_.size(); i++)
+			workers_[i].join();
+	}
+
+	template <class T> std::shared_future<T> submit(std::function<T()> fn) {
+		std::shared_ptr<std::packaged_task<T()> > task = std::make_shared<std::packaged_task<T()> >(fn);
+		std::shared_future<T> result = task->get_future().share();
+		if (workers_.empty()) {
+			(*task)();
+			return result;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.push_back([task]() { (*task)(); });
+		}
+		wake_.notify_one();
+		return result;
+	}
+};
+
+namespace {
+	const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+	const unsigned long long FNV_PRIME  = 1099511628211ULL;
+
+	// FNV-1a, chained from an initial state so that several pieces can be folded into one hash
+	unsigned long long hash_bytes(const void* data, size_t size, unsigned long long h) {
+		for (size_t i = 0; i < size; i++) {
+			h ^= ((const unsigned char*)data)[i];
+			h *= FNV_PRIME;
+		}
+		return h;
+	}
+
+	// FNV-1a over the raw file bytes, what assets are keyed on and what tells the caches on disk apart across
+	// runs; a missing file leaves the state untouched
+	unsigned long long hash_file(const std::string& filename, unsigned long long h) {
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in.is_open()) return h;
+		char buf[1 << 16];
+		while (in) {
+			in.read(buf, sizeof(buf));
+			h = hash_bytes(buf, (size_t)in.gcount(), h);
+		}
+		return h;
+	}
+
+	// FNV-1a over what identifies the file without reading it: the file itself (device and inode, the path
+	// where there are none), its size and modification time, down to the nanosecond where the platform keeps
+	// it so that a rewrite within the same second still shows; a missing file leaves the state untouched
+	unsigned long long stamp_file(const std::string& filename, unsigned long long h) {
+		struct stat st;
+		if (stat(filename.c_str(), &st) != 0) return h;
+#ifdef _WIN32
+		h = hash_bytes(filename.data(), filename.size(), h);
+#else
+		h = hash_bytes(&st.st_dev, sizeof(st.st_dev), h);
+		h = hash_bytes(&st.st_ino, sizeof(st.st_ino), h);
+#endif
+		long long size = st.st_size, mtime = st.st_mtime;
+		h = hash_bytes(&size, sizeof(size), h);
+#ifdef __linux__
+		long long nsec = st.st_mtim.tv_nsec;
+		h = hash_bytes(&nsec, sizeof(nsec), h);
+#endif
+		return hash_bytes(&mtime, sizeof(mtime), h);
+	}
+}
+
+AssetCache::AssetCache(size_t budget, int nthreads) : compress_textures_(false), build_lods_(false), budget_(budget), usage_(0), clock_(0),
+	nthreads_(nthreads), pool_(NULL) {
+}
+
+AssetCache::~AssetCache() {
+	delete pool_; // joins the workers before the slots they write to go away
+}
+
+AssetPool* AssetCache::pool() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!pool_) pool_ = new AssetPool(nthreads_);
+	return pool_;
+}
+
+template <class T, class StampFn, class HashFn, class LoadFn>
+std::shared_ptr<T> AssetCache::acquire(std::map<std::string, Path>& paths, std::map<Hash, std::shared_ptr<Slot<T> > >& slots,
+	const std::string& key, StampFn stamp, HashFn hash, LoadFn load) {
+	// a path whose stamp has not changed keeps the content hash it had, otherwise its contents are hashed
+	// again; both outside the lock
+	Hash s = stamp(), h = 0;
+	bool known = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		typename std::map<std::string, Path>::iterator p = paths.find(key);
+		if (p != paths.end() && p->second.stamp == s) {
+			h = p->second.content;
+			known = true;
+		}
+	}
+	if (!known) h = hash();
+
+	// the slot is pinned from the moment it is found until the asset has been handed out, so that trim()
+	// never evicts it while it is being loaded or before the caller holds a reference
+	std::shared_ptr<Slot<T> > slot;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		Path& path = paths[key];
+		path.stamp = s;
+		path.content = h;
+		std::shared_ptr<Slot<T> >& found = slots[h];
+		if (!found) found = std::make_shared<Slot<T> >(); // never loaded, or evicted since
+		slot = found;
+		slot->pins++;
+	}
+
+	// concurrent requests for the same contents wait here for the one that got to load them
+	std::shared_ptr<T> result;
+	bool fresh = false;
+	std::call_once(slot->once, [&]() {
+		std::shared_ptr<T> asset = load(h);
+		std::lock_guard<std::mutex> lock(mutex_);
+		slot->asset = result = asset;
+		slot->bytes = asset->memory_usage();
+		usage_ += slot->bytes;
+		fresh = true;
+	});
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!fresh) result = slot->asset;
+	slot->last_use = ++clock_;
+	slot->pins--;
+	if (fresh) trim();
+	return result;
+}
+
+std::shared_ptr<Model> AssetCache::model(const std::string& filename) {
+	bool compress = texture_compression();
+	bool lods = lod_generation();
+	std::string texture = Model::texture_path(filename, "_diffuse.tga");
+	return acquire(model_paths_, models_, filename + (compress ? "#bc1" : "") + (lods ? "#lod" : ""),
+		[&]() { return stamp_file(texture, stamp_file(filename, FNV_OFFSET)); },
+		[&]() {
+			return hash_file(texture, hash_file(filename, FNV_OFFSET)) ^
+				(compress ? FNV_PRIME << 1 : 0) ^ (lods ? FNV_PRIME << 2 : 0);
+		},
+		[&](Hash) {
+			std::shared_ptr<Model> model = std::make_shared<Model>(filename.c_str(), this);
+			if (lods)
+				model->build_lods(filename + ".lod", hash_file(filename, FNV_OFFSET));
+			return model;
+		});
+}
+
+std::shared_ptr<TGAImage> AssetCache::texture(const std::string& filename, bool flip_v) {
+	return acquire(texture_paths_, textures_, filename + (flip_v ? "#flip_v" : ""),
+		[&]() { return stamp_file(filename, FNV_OFFSET); },
+		[&]() { return hash_file(filename, FNV_OFFSET) ^ (flip_v ? FNV_PRIME : 0); },
+		[&](Hash) {
+			std::shared_ptr<TGAImage> img = std::make_shared<TGAImage>();
+			if (img->read_tga_file(filename.c_str()) && flip_v)
+				img->flip_vertically();
+			return img;
+		});
+}
+
+// compressed from the image at load time, or read back from filename.bc1 when that was made from the same image,
+// as told by the content hash the slot is keyed on
+std::shared_ptr<BlockTexture> AssetCache::block_texture(const std::string& filename, bool flip_v) {
+	return acquire(block_texture_paths_, block_textures_, filename + (flip_v ? "#flip_v" : ""),
+		[&]() { return stamp_file(filename, FNV_OFFSET); },
+		[&]() { return hash_file(filename, FNV_OFFSET) ^ (flip_v ? FNV_PRIME : 0); },
+		[&](Hash source) {
+			std::string cached = filename + ".bc1";
+			std::shared_ptr<BlockTexture> blocks = std::make_shared<BlockTexture>();
+			if (blocks->read_bc1_file(cached.c_str(), source))
+				return blocks;
+			TGAImage img;
+			if (!img.read_tga_file(filename.c_str()))
+				return blocks;
+			if (flip_v)
+				img.flip_vertically();
+			blocks = std::make_shared<BlockTexture>(img);
+			blocks->write_bc1_file(cached.c_str(), source);
+			return blocks;
+		});
+}
+
+std::shared_future<std::shared_ptr<Model> > AssetCache::model_async(const std::string& filename) {
+	return pool()->submit<std::shared_ptr<Model> >([this, filename]() { return model(filename); });
+}
+
+std::shared_future<std::shared_ptr<TGAImage> > AssetCache::texture_async(const std::string& filename, bool flip_v) {
+	return pool()->submit<std::shared_ptr<TGAImage> >([this, filename, flip_v]() { return texture(filename, flip_v); });
+}
+
+void AssetCache::set_texture_compression(bool compress) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	compress_textures_ = compress;
+}
+
+bool AssetCache::texture_compression() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return compress_textures_;
+}
+
+void AssetCache::set_lod_generation(bool build) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	build_lods_ = build;
+}
+
+bool AssetCache::lod_generation() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return build_lods_;
+}
+
+void AssetCache::set_budget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	budget_ = bytes;
+	trim();
+}
+
+size_t AssetCache::memory_usage() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return usage_;
+}
+
+void AssetCache::evict() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t budget = budget_;
+	budget_ = 1; // drop everything that is not in use
+	trim();
+	budget_ = budget;
+}
+
+// a slot is a candidate only once it is loaded, no acquire() has it pinned and the cache holds the last
+// reference to it
+template <class T>
+bool AssetCache::find_victim(std::map<Hash, std::shared_ptr<Slot<T> > >& slots, unsigned long& oldest, Hash& victim) {
+	bool found = false;
+	for (typename std::map<Hash, std::shared_ptr<Slot<T> > >::iterator it = slots.begin(); it != slots.end(); ++it) {
+		Slot<T>& slot = *it->second;
+		if (!slot.asset || slot.pins > 0 || slot.asset.use_count() > 1 || slot.last_use >= oldest) continue;
+		oldest = slot.last_use;
+		victim = it->first;
+		found = true;
+	}
+	return found;
+}
+
+// caller holds mutex_
+void AssetCache::trim() {
+	while (budget_ && usage_ > budget_) {
+		unsigned long oldest = (unsigned long)-1;
+		Hash victim = 0;
+		bool is_model = find_victim(models_, oldest, victim);
+		bool is_texture = find_victim(textures_, oldest, victim);
+		bool is_block_texture = find_victim(block_textures_, oldest, victim);
+		if (is_block_texture) {
+			usage_ -= block_textures_[victim]->bytes;
+			block_textures_.erase(victim);
+		} else if (is_texture) {
+			usage_ -= textures_[victim]->bytes;
+			textures_.erase(victim);
+		} else if (is_model) {
+			usage_ -= models_[victim]->bytes;
+			models_.erase(victim);
+		} else {
+			break; // everything left is referenced from outside
+		}
+	}
+}
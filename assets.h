@@ -0,0 +1,79 @@
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <future>
+#include "tgaimage.h"
+
+class Model;
+class AssetPool;
+class BlockTexture;
+
+// Shared cache of models and textures. Assets are keyed by the contents of their files, so the same
+// contents reached through two different paths are parsed once and handed out as one shared handle. The
+// contents are only hashed again once a path's stamp (file identity, size and modification time) changes.
+// Entries that nobody outside the cache references are evicted (least recently used first)
+// whenever the total size goes over the budget; a budget of 0 means unlimited. With texture compression
+// on, models loaded from then on get their diffuse maps as block textures, with lod generation on they
+// get levels of detail, kept next to the mesh in filename.lod. The loader threads behind the async calls
+// are only started by the first of them.
+class AssetCache {
+private:
+	template <class T> struct Slot {
+		std::once_flag once;
+		std::shared_ptr<T> asset;
+		size_t bytes;
+		unsigned long last_use;
+		int pins; // acquire() calls between finding the slot and handing out its asset
+		Slot() : bytes(0), last_use(0), pins(0) {}
+	};
+	typedef unsigned long long Hash;
+	struct Path {
+		Hash stamp;   // of the files the asset is read from, when their contents were last hashed
+		Hash content; // the key of the asset's slot
+	};
+
+	std::mutex mutex_;
+	std::map<std::string, Path> model_paths_;
+	std::map<std::string, Path> texture_paths_;
+	std::map<std::string, Path> block_texture_paths_;
+	std::map<Hash, std::shared_ptr<Slot<Model> > > models_;
+	std::map<Hash, std::shared_ptr<Slot<TGAImage> > > textures_;
+	std::map<Hash, std::shared_ptr<Slot<BlockTexture> > > block_textures_;
+	bool compress_textures_;
+	bool build_lods_;
+	size_t budget_;
+	size_t usage_;
+	unsigned long clock_;
+	int nthreads_;
+	AssetPool* pool_; // made by the first async request
+
+	template <class T, class StampFn, class HashFn, class LoadFn>
+	std::shared_ptr<T> acquire(std::map<std::string, Path>& paths, std::map<Hash, std::shared_ptr<Slot<T> > >& slots,
+		const std::string& key, StampFn stamp, HashFn hash, LoadFn load);
+	AssetPool* pool();
+	template <class T> bool find_victim(std::map<Hash, std::shared_ptr<Slot<T> > >& slots, unsigned long& oldest, Hash& victim);
+	void trim();
+public:
+	AssetCache(size_t budget = 0, int nthreads = 2);
+	~AssetCache();
+
+	std::shared_ptr<Model> model(const std::string& filename);
+	std::shared_ptr<TGAImage> texture(const std::string& filename, bool flip_v = false);
+	std::shared_ptr<BlockTexture> block_texture(const std::string& filename, bool flip_v = false);
+	std::shared_future<std::shared_ptr<Model> > model_async(const std::string& filename);
+	std::shared_future<std::shared_ptr<TGAImage> > texture_async(const std::string& filename, bool flip_v = false);
+
+	void set_texture_compression(bool compress);
+	bool texture_compression();
+	void set_lod_generation(bool build);
+	bool lod_generation();
+	void set_budget(size_t bytes);
+	size_t memory_usage();
+	void evict();
+};
+
+#endif //__ASSETS_H__
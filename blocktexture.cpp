@@ -0,0 +1,273 @@
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "blocktexture.h"
+
+static const char BC1_MAGIC[4] = { 'B', 'C', '1', 'T' };
+static const int BC1_VERSION = 2; // 2: grayscale images are encoded as gray, not blue
+static const int BC1_MAX_SIZE = 65535; // what a TGA header can hold
+
+// ids instead of addresses key the decode cache, so that a texture allocated where a freed one used to
+// be never hits on its predecessor's blocks
+static std::atomic<unsigned int> nextId(1);
+
+namespace {
+	// direct mapped, one per thread so that samplers never share or lock it; zero initialized (id 0 is
+	// never handed out) and without a constructor, so thread_local access needs no initialization guard.
+	// Entries are indexed by the block's position within an 8x8 tile of blocks, so that the blocks under
+	// a triangle's texture footprint, which spreads over neighbouring rows as much as columns, do not evict
+	// each other; an entry keeps the block's decoded palette and its indices, which is all a lookup needs
+	struct DecodeCache {
+		static const int SIZE = 64;
+		struct Entry {
+			unsigned int id;
+			int block;
+			unsigned int indices;
+			unsigned int colors[4];
+		};
+		Entry entries[SIZE];
+	};
+	thread_local DecodeCache decodeCache;
+
+	unsigned short pack565(const float c[3]) {
+		int r = std::min(31, std::max(0, (int)(c[0] * 31 / 255.f + .5f)));
+		int g = std::min(63, std::max(0, (int)(c[1] * 63 / 255.f + .5f)));
+		int b = std::min(31, std::max(0, (int)(c[2] * 31 / 255.f + .5f)));
+		return (unsigned short)((r << 11) | (g << 5) | b);
+	}
+
+	void unpack565(unsigned short c, unsigned char rgb[3]) {
+		int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+		rgb[0] = (unsigned char)((r << 3) | (r >> 2));
+		rgb[1] = (unsigned char)((g << 2) | (g >> 4));
+		rgb[2] = (unsigned char)((b << 3) | (b >> 2));
+	}
+
+	int distance(const unsigned char a[3], const unsigned char b[3]) {
+		int d = 0;
+		for (int j = 0; j < 3; j++) d += (a[j] - b[j]) * (a[j] - b[j]);
+		return d;
+	}
+}
+
+BlockTexture::BlockTexture() : width_(0), height_(0), blocksX_(0), blocks_(), id_(nextId++) {
+}
+
+// texels outside the image on the right and bottom edges repeat the last column and row; a grayscale image
+// only fills b, which goes to all three channels
+BlockTexture::BlockTexture(TGAImage& image) : width_(image.get_width()), height_(image.get_height()),
+	blocksX_((image.get_width() + 3) / 4), blocks_(), id_(nextId++) {
+	int blocksY = (height_ + 3) / 4;
+	bool gray = image.get_bytespp() == TGAImage::GRAYSCALE;
+	blocks_.resize((size_t)blocksX_ * blocksY);
+	for (int by = 0; by < blocksY; by++) {
+		for (int bx = 0; bx < blocksX_; bx++) {
+			unsigned char texels[16][3];
+			for (int i = 0; i < 16; i++) {
+				TGAColor c = image.get(std::min(bx * 4 + i % 4, width_ - 1), std::min(by * 4 + i / 4, height_ - 1));
+				texels[i][0] = gray ? c.b : c.r;
+				texels[i][1] = gray ? c.b : c.g;
+				texels[i][2] = c.b;
+			}
+			encode(texels, blocks_[bx + by * blocksX_]);
+		}
+	}
+}
+
+// colors of the four palette entries as the decoder sees them; color0 > color1 selects the four color
+// mode with two interpolated entries, otherwise the third is the midpoint and the fourth black
+void BlockTexture::palette(const Block& block, unsigned char colors[4][3]) {
+	unpack565(block.color0, colors[0]);
+	unpack565(block.color1, colors[1]);
+	for (int j = 0; j < 3; j++) {
+		if (block.color0 > block.color1) {
+			colors[2][j] = (unsigned char)((2 * colors[0][j] + colors[1][j]) / 3);
+			colors[3][j] = (unsigned char)((colors[0][j] + 2 * colors[1][j]) / 3);
+		} else {
+			colors[2][j] = (unsigned char)((colors[0][j] + colors[1][j]) / 2);
+			colors[3][j] = 0;
+		}
+	}
+}
+
+// endpoints from the extremes of the texels along their principal axis, then one least squares refit of
+// the endpoints to the chosen indices, kept if it lowers the error
+void BlockTexture::encode(const unsigned char texels[16][3], Block& block) {
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+		for (int j = 0; j < 3; j++) mean[j] += texels[i][j] / 16.f;
+	float cov[3][3] = { { 0 } };
+	for (int i = 0; i < 16; i++)
+		for (int j = 0; j < 3; j++)
+			for (int k = 0; k < 3; k++) cov[j][k] += (texels[i][j] - mean[j]) * (texels[i][k] - mean[k]);
+	float axis[3] = { 1, 1, 1 };
+	for (int iter = 0; iter < 8; iter++) {
+		float next[3];
+		for (int j = 0; j < 3; j++) next[j] = cov[j][0] * axis[0] + cov[j][1] * axis[1] + cov[j][2] * axis[2];
+		float norm = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (norm < 1e-6f) break; // flat block, any axis will do
+		for (int j = 0; j < 3; j++) axis[j] = next[j] / norm;
+	}
+	float lo = 1e30f, hi = -1e30f;
+	for (int i = 0; i < 16; i++) {
+		float t = 0;
+		for (int j = 0; j < 3; j++) t += (texels[i][j] - mean[j]) * axis[j];
+		lo = std::min(lo, t);
+		hi = std::max(hi, t);
+	}
+	float end0[3], end1[3];
+	for (int j = 0; j < 3; j++) {
+		end0[j] = mean[j] + axis[j] * hi;
+		end1[j] = mean[j] + axis[j] * lo;
+	}
+
+	int bestError = -1;
+	for (int pass = 0; pass < 2; pass++) {
+		Block candidate;
+		candidate.color0 = pack565(end0);
+		candidate.color1 = pack565(end1);
+		if (candidate.color0 < candidate.color1) {
+			std::swap(candidate.color0, candidate.color1);
+			std::swap(end0, end1);
+		}
+		unsigned char colors[4][3];
+		palette(candidate, colors);
+		candidate.indices = 0;
+		int error = 0;
+		int count = candidate.color0 == candidate.color1 ? 1 : 4;
+		int chosen[16];
+		for (int i = 0; i < 16; i++) {
+			int best = 0, bestDistance = distance(texels[i], colors[0]);
+			for (int k = 1; k < count; k++) {
+				int d = distance(texels[i], colors[k]);
+				if (d < bestDistance) {
+					bestDistance = d;
+					best = k;
+				}
+			}
+			chosen[i] = best;
+			candidate.indices |= (unsigned int)best << (2 * i);
+			error += bestDistance;
+		}
+		if (bestError < 0 || error < bestError) {
+			bestError = error;
+			block = candidate;
+		}
+		if (count == 1) break;
+
+		// texel = w * end0 + (1 - w) * end1 with w fixed by its index; solve the 2x2 normal equations
+		static const float weights[4] = { 1.f, 0.f, 2.f / 3, 1.f / 3 };
+		float aa = 0, ab = 0, bb = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; i++) {
+			float w = weights[chosen[i]];
+			aa += w * w;
+			ab += w * (1 - w);
+			bb += (1 - w) * (1 - w);
+			for (int j = 0; j < 3; j++) {
+				ax[j] += w * texels[i][j];
+				bx[j] += (1 - w) * texels[i][j];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (std::abs(det) < 1e-6f) break;
+		for (int j = 0; j < 3; j++) {
+			end0[j] = std::min(255.f, std::max(0.f, (ax[j] * bb - bx[j] * ab) / det));
+			end1[j] = std::min(255.f, std::max(0.f, (bx[j] * aa - ax[j] * ab) / det));
+		}
+	}
+}
+
+// palette of a block as TGAColor values
+void BlockTexture::decode(int index, unsigned int values[4]) const {
+	unsigned char colors[4][3];
+	palette(blocks_[index], colors);
+	for (int k = 0; k < 4; k++)
+		values[k] = TGAColor(colors[k][0], colors[k][1], colors[k][2], 0).val;
+}
+
+TGAColor BlockTexture::get(int x, int y) const {
+	if (blocks_.empty() || x < 0 || y < 0 || x >= width_ || y >= height_) {
+		return TGAColor();
+	}
+	int index = x / 4 + (y / 4) * blocksX_;
+	int slot = ((x >> 2) & 7) | (((y >> 2) & 7) << 3);
+	DecodeCache::Entry& entry = decodeCache.entries[(slot ^ (id_ * 0x9e3779b1u >> 20)) & (DecodeCache::SIZE - 1)];
+	if (entry.id != id_ || entry.block != index) {
+		decode(index, entry.colors);
+		entry.indices = blocks_[index].indices;
+		entry.id = id_;
+		entry.block = index;
+	}
+	return TGAColor(entry.colors[(entry.indices >> (2 * ((x & 3) + (y & 3) * 4))) & 3], 3);
+}
+
+int BlockTexture::get_width() const {
+	return width_;
+}
+
+int BlockTexture::get_height() const {
+	return height_;
+}
+
+size_t BlockTexture::memory_usage() {
+	return blocks_.capacity() * sizeof(Block);
+}
+
+// false when the file is missing, damaged or was made from another image than source
+bool BlockTexture::read_bc1_file(const char* filename, unsigned long long source) {
+	std::ifstream in(filename, std::ios::binary);
+	if (!in.is_open()) return false;
+	BC1Header header;
+	in.read((char*)&header, sizeof(header));
+	if (!in.good() || memcmp(header.magic, BC1_MAGIC, 4) || header.version != BC1_VERSION || header.source != source ||
+		header.width <= 0 || header.height <= 0 || header.width > BC1_MAX_SIZE || header.height > BC1_MAX_SIZE) {
+		return false;
+	}
+	// blocks are only made once the file is known to hold them all
+	int blocksX = (header.width + 3) / 4, blocksY = (header.height + 3) / 4;
+	size_t count = (size_t)blocksX * blocksY;
+	std::streampos start = in.tellg();
+	in.seekg(0, std::ios::end);
+	if (!in.good() || (size_t)(in.tellg() - start) < count * sizeof(Block)) {
+		std::cerr << "bad block texture file " << filename << "\n";
+		return false;
+	}
+	in.seekg(start);
+	std::vector<Block> blocks(count);
+	in.read((char*)&blocks[0], blocks.size() * sizeof(Block));
+	if (!in.good()) {
+		std::cerr << "bad block texture file " << filename << "\n";
+		return false;
+	}
+	width_ = header.width;
+	height_ = header.height;
+	blocksX_ = blocksX;
+	blocks_.swap(blocks);
+	id_ = nextId++;
+	return true;
+}
+
+bool BlockTexture::write_bc1_file(const char* filename, unsigned long long source) {
+	std::ofstream out(filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	BC1Header header;
+	memcpy(header.magic, BC1_MAGIC, 4);
+	header.version = BC1_VERSION;
+	header.width = width_;
+	header.height = height_;
+	header.source = source;
+	out.write((char*)&header, sizeof(header));
+	if (!blocks_.empty())
+		out.write((char*)&blocks_[0], blocks_.size() * sizeof(Block));
+	if (!out.good()) {
+		std::cerr << "can't write the block texture file " << filename << "\n";
+		return false;
+	}
+	return true;
+}
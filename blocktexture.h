@@ -0,0 +1,47 @@
+#ifndef __BLOCKTEXTURE_H__
+#define __BLOCKTEXTURE_H__
+
+#include <vector>
+#include "tgaimage.h"
+
+#pragma pack(push,1)
+struct BC1Header {
+	char magic[4];
+	int version;
+	int width;
+	int height;
+	unsigned long long source; // hash of the image the blocks were compressed from
+};
+#pragma pack(pop)
+
+// RGB texture compressed into 4x4 texel blocks, BC1 layout without alpha: two RGB565 endpoints and a
+// 2 bit palette index per texel, 4 bits per texel against 24 or 32 for the TGAImage it was made from.
+// get() decodes the palette of a whole block at a time into a small per thread cache, so that neighbouring
+// lookups only pick their texel's entry.
+class BlockTexture {
+private:
+	struct Block {
+		unsigned short color0, color1;
+		unsigned int indices; // texel i of the block (row major) in bits 2i and 2i+1
+	};
+	int width_;
+	int height_;
+	int blocksX_;
+	std::vector<Block> blocks_;
+	unsigned int id_;
+
+	static void encode(const unsigned char texels[16][3], Block& block);
+	static void palette(const Block& block, unsigned char colors[4][3]);
+	void decode(int index, unsigned int values[4]) const;
+public:
+	BlockTexture();
+	BlockTexture(TGAImage& image);
+	bool read_bc1_file(const char* filename, unsigned long long source);
+	bool write_bc1_file(const char* filename, unsigned long long source);
+	TGAColor get(int x, int y) const;
+	int get_width() const;
+	int get_height() const;
+	size_t memory_usage();
+};
+
+#endif //__BLOCKTEXTURE_H__
@@ -0,0 +1,293 @@
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <algorithm>
+#include "farm.h"
+#include "arena.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#ifndef _WIN32
+namespace {
+	bool read_all(int fd, void* data, size_t n) {
+		char* p = (char*)data;
+		while (n > 0) {
+			ssize_t got = read(fd, p, n);
+			if (got <= 0) return false;
+			p += got;
+			n -= got;
+		}
+		return true;
+	}
+
+	bool write_all(int fd, const void* data, size_t n) {
+		const char* p = (const char*)data;
+		while (n > 0) {
+			ssize_t put = write(fd, p, n);
+			if (put <= 0) return false;
+			p += put;
+			n -= put;
+		}
+		return true;
+	}
+}
+#endif
+
+RenderFarm::RenderFarm(int width, int height, int tileSize) : width_(width), height_(height), tileSize_(tileSize),
+	rowCost_((height + tileSize - 1) / tileSize, 1.) {
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN); // a worker going away shows up as a failed write instead
+#endif
+}
+
+RenderFarm::~RenderFarm() {
+	while (!workers_.empty()) {
+#ifndef _WIN32
+		RegionJob quit = { -1, 0, 0, 0 };
+		write_all(workers_.back().fd, &quit, sizeof(quit));
+#endif
+		drop((int)workers_.size() - 1);
+	}
+}
+
+void RenderFarm::drop(int i) {
+#ifndef _WIN32
+	close(workers_[i].fd);
+	if (workers_[i].pid > 0) waitpid(workers_[i].pid, NULL, 0);
+#endif
+	workers_.erase(workers_.begin() + i);
+}
+
+// forks count workers sharing everything set up so far; each renders into its own copy of frame
+bool RenderFarm::spawn(int count, TGAImage& frame, RenderFn render) {
+#ifndef _WIN32
+	for (int i = 0; i < count; i++) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+			std::cerr << "can't create a socket pair for worker " << i << "\n";
+			return false;
+		}
+		pid_t pid = fork();
+		if (pid < 0) {
+			std::cerr << "can't fork worker " << i << "\n";
+			close(fds[0]);
+			close(fds[1]);
+			return false;
+		}
+		if (pid == 0) {
+			close(fds[0]);
+			for (int j = 0; j < (int)workers_.size(); j++)
+				close(workers_[j].fd);
+			bool ok = serve(fds[1], frame, render);
+			_exit(ok ? 0 : 1); // skip the destructors of everything the parent owns
+		}
+		close(fds[1]);
+		Worker worker = { fds[0], (int)pid, "local " + std::to_string(i), 0, 0, 0. };
+		workers_.push_back(worker);
+	}
+	return true;
+#else
+	std::cerr << "local workers are not supported on this platform\n";
+	return false;
+#endif
+}
+
+// address is host:port of a worker started with --serve
+bool RenderFarm::connect(const std::string& address) {
+#ifndef _WIN32
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos) {
+		std::cerr << "worker address " << address << " is not host:port\n";
+		return false;
+	}
+	std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+	addrinfo hints, *res = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+		std::cerr << "can't resolve worker " << address << "\n";
+		return false;
+	}
+	int fd = -1;
+	for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		std::cerr << "can't connect to worker " << address << "\n";
+		return false;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	Worker worker = { fd, 0, address, 0, 0, 0. };
+	workers_.push_back(worker);
+	return true;
+#else
+	std::cerr << "remote workers are not supported on this platform\n";
+	return false;
+#endif
+}
+
+int RenderFarm::size() {
+	return (int)workers_.size();
+}
+
+// band of worker i in the last frame and the time it took
+void RenderFarm::band(int i, int& y0, int& y1, double& ms) {
+	y0 = workers_[i].y0;
+	y1 = workers_[i].y1;
+	ms = workers_[i].ms;
+}
+
+// cuts the rows of tiles into one band per worker of about the same estimated cost, at least one row each
+void RenderFarm::balance() {
+	int rows = (int)rowCost_.size();
+	int n = std::min((int)workers_.size(), rows);
+	double total = 0;
+	for (int r = 0; r < rows; r++)
+		total += rowCost_[r];
+	double sum = 0;
+	int row = 0;
+	for (int i = 0; i < (int)workers_.size(); i++) {
+		int first = row;
+		if (i < n) {
+			double target = total * (i + 1) / n;
+			// take rows while the band stays under its share, and leave one row for every worker after it
+			while (row < rows - (n - 1 - i) && (row == first || sum + rowCost_[row] / 2 <= target))
+				sum += rowCost_[row++];
+			if (i == n - 1) row = rows;
+		}
+		workers_[i].y0 = std::min(first * tileSize_, height_);
+		workers_[i].y1 = std::min(row * tileSize_, height_);
+	}
+}
+
+// renders a frame across the workers; false when one of them failed, it is dropped and the caller has to
+// render the frame some other way
+bool RenderFarm::render(int frame, const InstanceState* states, int count, TGAImage& image) {
+#ifndef _WIN32
+	if (count > MAX_INSTANCES) {
+		std::cerr << count << " instances are more than a render job can carry\n";
+		return false;
+	}
+	balance();
+	bool ok = true;
+	bool* failed = FrameArena::local().allocate<bool>(workers_.size());
+	for (int i = 0; i < (int)workers_.size(); i++) {
+		Worker& worker = workers_[i];
+		failed[i] = false;
+		if (worker.y0 >= worker.y1) continue;
+		RegionJob job = { frame, worker.y0, worker.y1, count };
+		failed[i] = !write_all(worker.fd, &job, sizeof(job)) ||
+			(count > 0 && !write_all(worker.fd, states, count * sizeof(InstanceState)));
+	}
+	int bytespp = image.get_bytespp();
+	for (int i = 0; i < (int)workers_.size(); i++) {
+		Worker& worker = workers_[i];
+		if (worker.y0 >= worker.y1 || failed[i]) continue;
+		RegionResult result;
+		failed[i] = !read_all(worker.fd, &result, sizeof(result)) || result.frame != frame ||
+			result.y0 != worker.y0 || result.y1 != worker.y1 ||
+			!read_all(worker.fd, image.buffer() + worker.y0 * width_ * bytespp, (size_t)(worker.y1 - worker.y0) * width_ * bytespp);
+		if (failed[i]) continue;
+		worker.ms = result.ms;
+		// spread the band's time evenly over its rows, blended with what earlier frames measured
+		int r0 = worker.y0 / tileSize_, r1 = (worker.y1 + tileSize_ - 1) / tileSize_;
+		for (int r = r0; r < r1; r++)
+			rowCost_[r] = .5 * rowCost_[r] + .5 * std::max(result.ms, 1e-3) / (r1 - r0);
+	}
+	for (int i = (int)workers_.size() - 1; i >= 0; i--) {
+		if (!failed[i]) continue;
+		std::cerr << "worker " << workers_[i].name << " lost\n";
+		drop(i);
+		ok = false;
+	}
+	return ok;
+#else
+	(void)frame; (void)states; (void)count; (void)image;
+	return false;
+#endif
+}
+
+// worker side: answers jobs on fd until told to quit or the coordinator goes away; every job is a frame
+// as far as the worker's arena goes
+bool RenderFarm::serve(int fd, TGAImage& frame, RenderFn render) {
+#ifndef _WIN32
+	int bytespp = frame.get_bytespp();
+	int width = frame.get_width();
+	FrameArena& arena = FrameArena::local();
+	for (;; arena.reset()) {
+		RegionJob job;
+		if (!read_all(fd, &job, sizeof(job))) return false;
+		if (job.frame < 0) return true;
+		if (job.instances < 0 || job.instances > MAX_INSTANCES || job.y0 < 0 || job.y1 > frame.get_height() || job.y0 > job.y1) {
+			std::cerr << "bad render job\n";
+			return false;
+		}
+		InstanceState* states = arena.allocate<InstanceState>(job.instances);
+		if (job.instances && !read_all(fd, states, job.instances * sizeof(InstanceState))) return false;
+
+		// processor time rather than wall time, so that workers sharing cores still report their own work
+		std::clock_t start = std::clock();
+		if (!render(job, states)) return false;
+		double elapsed = 1000. * (std::clock() - start) / CLOCKS_PER_SEC;
+
+		RegionResult result = { job.frame, job.y0, job.y1, elapsed };
+		if (!write_all(fd, &result, sizeof(result)) ||
+			!write_all(fd, frame.buffer() + job.y0 * width * bytespp, (size_t)(job.y1 - job.y0) * width * bytespp))
+			return false;
+	}
+#else
+	(void)fd; (void)frame; (void)render;
+	return false;
+#endif
+}
+
+// waits for one coordinator on port and serves it
+bool RenderFarm::serve_tcp(int port, TGAImage& frame, RenderFn render) {
+#ifndef _WIN32
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((unsigned short)port);
+	if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0) {
+		std::cerr << "can't listen on port " << port << "\n";
+		if (listener >= 0) close(listener);
+		return false;
+	}
+	std::cerr << "worker listening on port " << port << std::endl;
+	int fd = accept(listener, NULL, NULL);
+	close(listener);
+	if (fd < 0) {
+		std::cerr << "can't accept a coordinator on port " << port << "\n";
+		return false;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	bool ok = serve(fd, frame, render);
+	close(fd);
+	return ok;
+#else
+	std::cerr << "serving over TCP is not supported on this platform\n";
+	(void)port; (void)frame; (void)render;
+	return false;
+#endif
+}
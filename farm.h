@@ -0,0 +1,70 @@
+#ifndef __FARM_H__
+#define __FARM_H__
+
+#include <vector>
+#include <string>
+#include <functional>
+#include "tgaimage.h"
+
+// what a worker needs to bring its copy of an instance up to date
+struct InstanceState {
+	float offset[3];
+	float scale;
+};
+
+// Band of rows a worker renders: the coordinator sends the job followed by one InstanceState per instance,
+// the worker answers with a RegionResult followed by the rows of the band. Everything goes over the wire in
+// native byte order, so remote workers have to run on the same kind of machine.
+struct RegionJob {
+	int frame;     // -1 tells the worker to exit
+	int y0, y1;    // y1 exclusive
+	int instances; // at most MAX_INSTANCES
+};
+
+// most instance states a job may carry; workers refuse bigger jobs before allocating room for them
+const int MAX_INSTANCES = 1 << 16;
+
+struct RegionResult {
+	int frame;
+	int y0, y1;
+	double ms;     // processor time the worker spent rendering
+};
+
+// Sort-first parallel rendering. The frame is cut into horizontal bands of whole tiles, one per worker; every
+// worker holds its own copy of the scene, renders its band through the regular raster path and sends the pixels
+// back to be put together here. Workers are either forked local processes talking over socket pairs, or the
+// same binary with the same options started elsewhere with --serve and reached over TCP. Band heights follow
+// the render times of earlier frames, so that all workers end up with about the same amount of work.
+class RenderFarm {
+public:
+	// renders rows job.y0 to job.y1 of the worker's frame for the job.instances given instance states; false drops the worker
+	typedef std::function<bool(const RegionJob& job, const InstanceState* states)> RenderFn;
+private:
+	struct Worker {
+		int fd;
+		int pid;         // 0 for remote workers
+		std::string name;
+		int y0, y1;
+		double ms;
+	};
+	int width_, height_;
+	int tileSize_;
+	std::vector<Worker> workers_;
+	std::vector<double> rowCost_; // estimated render time of every row of tiles
+
+	void balance();
+	void drop(int i);
+public:
+	RenderFarm(int width, int height, int tileSize = 32);
+	~RenderFarm();
+	bool spawn(int count, TGAImage& frame, RenderFn render);
+	bool connect(const std::string& address);
+	int size();
+	void band(int i, int& y0, int& y1, double& ms);
+	bool render(int frame, const InstanceState* states, int count, TGAImage& image);
+
+	static bool serve(int fd, TGAImage& frame, RenderFn render);
+	static bool serve_tcp(int port, TGAImage& frame, RenderFn render);
+};
+
+#endif //__FARM_H__
@@ -8,7 +8,9 @@ template <> template <> Vec3<int>::Vec3(const Vec3<float>& v) : x(int(v.x + .5))
 template <> template <> Vec3<float>::Vec3(const Vec3<int>& v) : x(v.x), y(v.y), z(v.z) {}
 
 
-Matrix::Matrix(int r, int c) : m(std::vector<std::vector<float> >(r, std::vector<float>(c, 0.f))), rows(r), cols(c) { }
+Matrix::Matrix(int r, int c) : m(), rows(r), cols(c) {
+    assert(r > 0 && r <= MAX_ALLOC && c > 0 && c <= MAX_ALLOC);
+}
 
 int Matrix::nrows() {
     return rows;
@@ -28,7 +30,7 @@ Matrix Matrix::identity(int dimensions) {
     return E;
 }
 
-std::vector<float>& Matrix::operator[](const int i) {
+float* Matrix::operator[](const int i) {
     assert(i >= 0 && i < rows);
     return m[i];
 }
@@ -58,7 +60,8 @@ Matrix Matrix::transpose() {
 Matrix Matrix::inverse() {
     assert(rows == cols);
     // augmenting the square matrix with the identity matrix of the same dimensions a => [ai]
-    Matrix result(rows, cols * 2);
+    float result[MAX_ALLOC][MAX_ALLOC * 2] = {};
+    int resultCols = cols * 2;
     for (int i = 0; i < rows; i++)
         for (int j = 0; j < cols; j++)
             result[i][j] = m[i][j];
@@ -67,23 +70,23 @@ Matrix Matrix::inverse() {
     // first pass
     for (int i = 0; i < rows - 1; i++) {
         // normalize the first row
-        for (int j = result.cols - 1; j >= 0; j--)
+        for (int j = resultCols - 1; j >= 0; j--)
             result[i][j] /= result[i][i];
         for (int k = i + 1; k < rows; k++) {
             float coeff = result[k][i];
-            for (int j = 0; j < result.cols; j++) {
+            for (int j = 0; j < resultCols; j++) {
                 result[k][j] -= result[i][j] * coeff;
             }
         }
     }
     // normalize the last row
-    for (int j = result.cols - 1; j >= rows - 1; j--)
+    for (int j = resultCols - 1; j >= rows - 1; j--)
         result[rows - 1][j] /= result[rows - 1][rows - 1];
     // second pass
     for (int i = rows - 1; i > 0; i--) {
         for (int k = i - 1; k >= 0; k--) {
             float coeff = result[k][i];
-            for (int j = 0; j < result.cols; j++) {
+            for (int j = 0; j < resultCols; j++) {
                 result[k][j] -= result[i][j] * coeff;
             }
         }
@@ -2,6 +2,8 @@
 #define __GEOMETRY_H__
 
 #include <cmath>
+#include <vector>
+#include <iostream>
 
 template <class t> struct Vec2 {
     union {
@@ -87,9 +89,12 @@ template <class t> std::ostream& operator<<(std::ostream& s, Vec3<t>& v) {
 //////////////////////////////////////////////////////////////////////////////////////////////
 
 const int DEFAULT_ALLOC = 4;
+const int MAX_ALLOC = 4;
 
+// up to MAX_ALLOC x MAX_ALLOC, stored inline so that building, multiplying and inverting matrices never
+// touches the heap
 class Matrix {
-    std::vector<std::vector<float> > m;
+    float m[MAX_ALLOC][MAX_ALLOC];
     int rows, cols;
 public:
     Matrix(int r = DEFAULT_ALLOC, int c = DEFAULT_ALLOC);
@@ -97,7 +102,7 @@ public:
     inline int ncols();
 
     static Matrix identity(int dimensions);
-    std::vector<float>& operator[](const int i);
+    float* operator[](const int i);
     Matrix operator*(const Matrix& a);
     Matrix transpose();
     Matrix inverse();
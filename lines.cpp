@@ -0,0 +1,206 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "lines.h"
+
+// Liang-Barsky against [xmin, xmax] x [ymin, ymax], false when nothing is left of the segment
+static bool ClipSegment(float& x0, float& y0, float& x1, float& y1, float xmin, float ymin, float xmax, float ymax)
+{
+    float t0 = 0, t1 = 1;
+    float dx = x1 - x0, dy = y1 - y0;
+    float p[4] = { -dx, dx, -dy, dy };
+    float q[4] = { x0 - xmin, xmax - x0, y0 - ymin, ymax - y0 };
+    for (int i = 0; i < 4; i++)
+    {
+        if (p[i] == 0)
+        {
+            if (q[i] < 0)
+                return false;
+            continue;
+        }
+        float r = q[i] / p[i];
+        if (p[i] < 0)
+            t0 = std::max(t0, r);
+        else
+            t1 = std::min(t1, r);
+        if (t0 > t1)
+            return false;
+    }
+    float ox = x0, oy = y0;
+    x0 = ox + t0 * dx; y0 = oy + t0 * dy;
+    x1 = ox + t1 * dx; y1 = oy + t1 * dy;
+    return true;
+}
+
+// minor axis steps Bresenham below has taken by step i of a line major pixels long and minor pixels across;
+// its error term at step i is 2 * minor * (i + 1) - major - 2 * major * MinorSteps(i)
+static long long MinorSteps(long long major, long long minor, long long i)
+{
+    return major ? (2 * minor * i + major - 1) / (2 * major) : 0;
+}
+
+// first of the steps 0..n whose minor offset reaches k, n + 1 when none does; the offset never decreases
+static long long FirstStepReaching(long long major, long long minor, long long n, long long k)
+{
+    long long lo = 0, hi = n + 1;
+    while (lo < hi)
+    {
+        long long mid = (lo + hi) / 2;
+        if (MinorSteps(major, minor, mid) >= k)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+// steps t for which c + step * t stays within 0..size - 1
+static void AxisRange(long long c, int step, int size, long long& lo, long long& hi)
+{
+    lo = step > 0 ? -c : c - (size - 1);
+    hi = step > 0 ? size - 1 - c : c;
+}
+
+void line(int x0, int y0, int x1, int y1, TGAImage& image, TGAColor color)
+{
+    int width = image.get_width(), height = image.get_height();
+    int bytespp = image.get_bytespp();
+    unsigned char* data = image.buffer();
+    if (!data)
+        return;
+
+    int dx = std::abs(x1 - x0), dy = std::abs(y1 - y0);
+    int sx = x1 > x0 ? 1 : -1, sy = y1 > y0 ? 1 : -1;
+    // walk the major axis one pixel at a time, the error term decides when to take a minor step
+    bool steep = dy > dx;
+    long long major = steep ? dy : dx, minor = steep ? dx : dy;
+    int majorStart = steep ? y0 : x0, minorStart = steep ? x0 : y0;
+    int majorDir = steep ? sy : sx, minorDir = steep ? sx : sy;
+    int majorSize = steep ? height : width, minorSize = steep ? width : height;
+
+    // clipping keeps the pixels of the whole line: only the steps that land in the image are walked, the walk
+    // starting from the error term the full line has at the first of them
+    long long first, last, lo, hi;
+    AxisRange(majorStart, majorDir, majorSize, lo, hi);
+    first = std::max(0LL, lo);
+    last = std::min(major, hi);
+    AxisRange(minorStart, minorDir, minorSize, lo, hi);
+    if (first > last || lo > hi)
+        return;
+    first = std::max(first, FirstStepReaching(major, minor, major, lo));
+    last = std::min(last, FirstStepReaching(major, minor, major, hi + 1) - 1);
+    if (first > last)
+        return;
+
+    long long k = MinorSteps(major, minor, first);
+    int a = majorStart + (int)first * majorDir, b = minorStart + (int)k * minorDir;
+    int x = steep ? b : a, y = steep ? a : b;
+    int stepMajor = (steep ? sy * width : sx) * bytespp;
+    int stepMinor = (steep ? sx : sy * width) * bytespp;
+
+    unsigned char* p = data + (x + y * width) * bytespp;
+    long long err = 2 * minor * (first + 1) - major - 2 * major * k;
+    for (long long i = first; i <= last; i++)
+    {
+        memcpy(p, color.raw, bytespp);
+        if (err > 0)
+        {
+            p += stepMinor;
+            err -= 2 * major;
+        }
+        err += 2 * minor;
+        p += stepMajor;
+    }
+}
+
+void line(Vec2i t0, Vec2i t1, TGAImage& image, TGAColor color)
+{
+    line(t0.x, t0.y, t1.x, t1.y, image, color);
+}
+
+static void Blend(TGAImage& image, int x, int y, TGAColor color, float alpha)
+{
+    if (x < 0 || y < 0 || x >= image.get_width() || y >= image.get_height())
+        return;
+    int bytespp = image.get_bytespp();
+    unsigned char* p = image.buffer() + (x + y * image.get_width()) * bytespp;
+    for (int i = 0; i < bytespp; i++)
+        p[i] = (unsigned char)(p[i] + (color.raw[i] - p[i]) * alpha + .5f);
+}
+
+static float Fract(float v)
+{
+    return v - std::floor(v);
+}
+
+void line_aa(float x0, float y0, float x1, float y1, TGAImage& image, TGAColor color)
+{
+    if (!image.buffer())
+        return;
+    // one pixel of margin, the two pixel wide footprint may still reach into the image
+    if (!ClipSegment(x0, y0, x1, y1, -1, -1, image.get_width(), image.get_height()))
+        return;
+
+    bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+    if (steep)
+    {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+    }
+    if (x0 > x1)
+    {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+    }
+    float dx = x1 - x0, dy = y1 - y0;
+    float gradient = dx == 0 ? 1 : dy / dx;
+
+    // endpoints are covered partially along the major axis
+    int xpxl1 = (int)std::floor(x0 + .5f);
+    float yend = y0 + gradient * (xpxl1 - x0);
+    float xgap = 1 - Fract(x0 + .5f);
+    int ypxl1 = (int)std::floor(yend);
+    int xpxl2 = (int)std::floor(x1 + .5f);
+    float yend2 = y1 + gradient * (xpxl2 - x1);
+    float xgap2 = Fract(x1 + .5f);
+    int ypxl2 = (int)std::floor(yend2);
+    if (steep)
+    {
+        Blend(image, ypxl1, xpxl1, color, (1 - Fract(yend)) * xgap);
+        Blend(image, ypxl1 + 1, xpxl1, color, Fract(yend) * xgap);
+        Blend(image, ypxl2, xpxl2, color, (1 - Fract(yend2)) * xgap2);
+        Blend(image, ypxl2 + 1, xpxl2, color, Fract(yend2) * xgap2);
+    }
+    else
+    {
+        Blend(image, xpxl1, ypxl1, color, (1 - Fract(yend)) * xgap);
+        Blend(image, xpxl1, ypxl1 + 1, color, Fract(yend) * xgap);
+        Blend(image, xpxl2, ypxl2, color, (1 - Fract(yend2)) * xgap2);
+        Blend(image, xpxl2, ypxl2 + 1, color, Fract(yend2) * xgap2);
+    }
+
+    float intery = yend + gradient;
+    for (int x = xpxl1 + 1; x < xpxl2; x++)
+    {
+        int y = (int)std::floor(intery);
+        float f = intery - y;
+        if (steep)
+        {
+            Blend(image, y, x, color, 1 - f);
+            Blend(image, y + 1, x, color, f);
+        }
+        else
+        {
+            Blend(image, x, y, color, 1 - f);
+            Blend(image, x, y + 1, color, f);
+        }
+        intery += gradient;
+    }
+}
+
+void triangle(Vec2i t0, Vec2i t1, Vec2i t2, TGAImage& image, TGAColor color)
+{
+    line(t0, t1, image, color);
+    line(t1, t2, image, color);
+    line(t2, t0, image, color);
+}
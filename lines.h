@@ -0,0 +1,17 @@
+#ifndef __LINES_H__
+#define __LINES_H__
+
+#include "geometry.h"
+#include "tgaimage.h"
+
+// integer Bresenham, clipped to the image up front so the inner loop writes straight into the buffer; a
+// clipped line keeps exactly the pixels of the unclipped one that fall inside
+void line(int x0, int y0, int x1, int y1, TGAImage& image, TGAColor color);
+void line(Vec2i t0, Vec2i t1, TGAImage& image, TGAColor color);
+
+// Xiaolin Wu antialiased line, blends color over what is already in the image
+void line_aa(float x0, float y0, float x1, float y1, TGAImage& image, TGAColor color);
+
+void triangle(Vec2i t0, Vec2i t1, Vec2i t2, TGAImage& image, TGAColor color);
+
+#endif //__LINES_H__
@@ -1,15 +1,31 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <fstream>
 
 #include "tgaimage.h"
 #include "model.h"
+#include "assets.h"
+#include "blocktexture.h"
 #include "geometry.h"
+#include "raster.h"
+#include "shadow.h"
+#include "scene.h"
+#include "tiles.h"
+#include "lines.h"
+#include "stream.h"
+#include "tilebuffer.h"
+#include "farm.h"
+#include "arena.h"
+#include "resample.h"
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red   = TGAColor(255, 0,   0,   255);
 const TGAColor green = TGAColor(0, 255, 0, 255);
-Model *model = NULL;
 
 const int width  = 800;
 const int height = 800;
@@ -17,8 +33,12 @@ const int depth = 255;
 
 const int pixCount = width * height;
 float zBuffer[pixCount];
+int zBufferFixed[pixCount];
+TileBuffer tileBuffer(width, height, TGAImage::RGB, -std::numeric_limits<float>::max());
 
 Vec3f light_dir(0, 0, -1);
+Vec3f view_dir(0, 0, -1);
+const int shadowMapSize = 1024;
 Vec3f camera(0, 0, 3);
 
 Vec3f m2v(Matrix m) {
@@ -46,184 +66,866 @@ Matrix viewport(float x, float y, float w, float h) {
     return m;
 }
 
-int getYForX(int x0, int y0, int x1, int y1, int x)
+Vec3f world2screen(Vec3f v)
 {
-    return y0 + (y1 - y0) * (x - x0) / (float)(x1 - x0);
+    return Vec3f(int((v.x + 1.) * width / 2. + .5), int((v.y + 1.) * height / 2. + .5), v.z);
 }
 
-int getYForX(Vec2i t0, Vec2i t1, int x)
+enum Pass
+{
+    PASS_SHADE,       // single pass, depth test and shading together
+    PASS_DEPTH,       // depth pre-pass, z buffer only
+    PASS_SHADE_EQUAL, // shading of the samples that survived the pre-pass
+    PASS_SHADE_FIXED, // single pass through the integer only rasterizer, fixed point depth in zBufferFixed
+    PASS_SHADE_TILED  // single pass into the compressed tiles of tileBuffer
+};
+
+// perspective divide by w = 1 - z / camera.z, what Projection does, then onto the screen
+Vec3f project(Vec3f v)
 {
-    return getYForX(t0.y, t0.x, t1.y, t1.x, x);
+    float w = 1 - v.z / camera.z;
+    return world2screen(Vec3f(v.x / w, v.y / w, v.z / w));
 }
 
-int getXForY(Vec2i t0, Vec2i t1, int y)
+void project_vertices(Vec3f* world_coords, Vec3f* screen_coords)
 {
-    return getYForX(t0.y, t0.x, t1.y, t1.x, y);
+    for (int j = 0; j < 3; j++) {
+        //screen_coords[j] = m2v(ViewPort * Projection * v2m(world_coords[j]));
+        screen_coords[j] = project(world_coords[j]);
+    }
 }
 
-void line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color)
+void project_face(Instance& instance, int iface, Vec3f* world_coords, Vec3f* screen_coords)
 {
-    bool steep = false;
-    if (std::abs(x0-x1)<std::abs(y0-y1))
+    for (int j = 0; j < 3; j++)
+        world_coords[j] = instance.world(instance.mesh()->face_vert(iface, j));
+    project_vertices(world_coords, screen_coords);
+}
+
+// world and screen position of every vertex of an instance, worked out the first time a face of the draw
+// needs it, exactly as project_face would; shared vertices are projected once instead of once per face. The
+// arrays come from the frame arena and go away with the frame
+struct ProjectedVertices
+{
+    Instance& instance;
+    Vec3f* world;
+    Vec3f* screen;
+    bool* done;
+
+    ProjectedVertices(Instance& instance) : instance(instance)
     {
-        std::swap(x0, y0);
-        std::swap(x1, y1);
-        steep = true;
+        int n = instance.model->nverts();
+        FrameArena& arena = FrameArena::local();
+        world = arena.allocate<Vec3f>(n);
+        screen = arena.allocate<Vec3f>(n);
+        done = arena.allocate<bool>(n);
+        std::fill(done, done + n, false);
     }
-    if (x0>x1)
+
+    void face(int iface, Vec3f* world_coords, Vec3f* screen_coords)
     {
-        std::swap(x0, x1);
-        std::swap(y0, y1);
+        for (int j = 0; j < 3; j++)
+        {
+            int v = instance.mesh()->face_vert(iface, j);
+            if (!done[v])
+            {
+                world[v] = instance.world(v);
+                screen[v] = project(world[v]);
+                done[v] = true;
+            }
+            world_coords[j] = world[v];
+            screen_coords[j] = screen[v];
+        }
     }
+};
 
-    for (int x = x0; x <= x1; x++)
+bool front_facing(Vec3f* world_coords)
+{
+    Vec3f n = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
+    n.normalize();
+    float intensity = n * view_dir;
+    return intensity > 0;
+}
+
+// the depth and shading passes into frame go through raster, the loop draw_instance looked up for the draw
+void draw_face(ProjectedVertices& vertices, int iface, Pass pass, const DrawCall& draw, TriangleFn raster)
+{
+    Model* model = draw.model;
+    ShadowMap* shadow = draw.shadow;
+    const DirtyTiles* mask = draw.mask;
+    Vec3f screen_coords[3];
+    Vec3f world_coords[3];
+    vertices.face(iface, world_coords, screen_coords);
+    if (!front_facing(world_coords))
+        return;
+
+    if (pass == PASS_DEPTH)
     {
-        int y = getYForX(x0, y0, x1, y1, x);
-        if (steep)
-            image.set(y, x, color);
-        else
-            image.set(x, y, color);
+        raster(draw, screen_coords, NULL, NULL);
+        return;
+    }
+
+    Vec2i uvs[3];
+    Vec3f light_coords[3];
+    for (int j = 0; j < 3; j++)
+    {
+        uvs[j] = model->uv(iface, j);
+        if (shadow)
+            light_coords[j] = shadow->to_light(world_coords[j]);
+    }
+    if (pass == PASS_SHADE_FIXED)
+    {
+        filled_triangle_fixed(screen_coords, *draw.image, uvs, model, zBufferFixed, mask);
+        return;
+    }
+    if (pass == PASS_SHADE_TILED)
+    {
+        filled_triangle(screen_coords, tileBuffer, uvs, model, shadow, light_coords, mask);
+        return;
+    }
+    raster(draw, screen_coords, uvs, light_coords);
+}
+
+struct MeshletStats
+{
+    int meshlets, offscreen, backfacing, occluded;
+    long long faces, fetched; // faces of the drawn instances, faces whose vertices were actually fetched
+
+    MeshletStats() : meshlets(0), offscreen(0), backfacing(0), occluded(0), faces(0), fetched(0) {}
+};
+
+// screen space box holding every vertex of the meshlet: the corners of its sphere's bounding cube, clipped to
+// the instance bounds, are projected; the projection is monotonic in each coordinate as long as z stays well
+// in front of the camera, past that there is no box and the meshlet cannot be culled on screen position or depth
+bool meshlet_screen_box(Instance& instance, const Meshlet& meshlet, Vec3f lo, Vec3f hi, Vec3f& screenLo, Vec3f& screenHi)
+{
+    Vec3f center = meshlet.center * instance.scale + instance.offset;
+    float radius = meshlet.radius * instance.scale;
+    for (int j = 0; j < 3; j++)
+    {
+        lo.raw[j] = std::max(lo.raw[j], center.raw[j] - radius);
+        hi.raw[j] = std::min(hi.raw[j], center.raw[j] + radius);
+    }
+    if (hi.z >= 1.f)
+        return false;
+
+    screenLo = Vec3f(std::numeric_limits<float>::max());
+    screenHi = Vec3f(-std::numeric_limits<float>::max());
+    for (int i = 0; i < 8; i++)
+    {
+        Vec3f corner = project(Vec3f(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z));
+        for (int j = 0; j < 3; j++)
+        {
+            screenLo.raw[j] = std::min(screenLo.raw[j], corner.raw[j]);
+            screenHi.raw[j] = std::max(screenHi.raw[j], corner.raw[j]);
+        }
+    }
+    return true;
+}
+
+// with stats, whole meshlets that face away from the viewer, fall outside the screen or, when shading without
+// a pre-pass, hide behind what earlier instances left in the z buffer are skipped before any of their vertices
+// is fetched; the faces of the remaining ones are drawn in the mesh's own face order, so that samples at equal
+// depth are resolved exactly as without meshlets
+void draw_instance(Instance& instance, Pass pass, TGAImage& frame, float zBuffer[], ShadowMap* shadow, const DirtyTiles* mask = NULL,
+                   MeshletStats* stats = NULL)
+{
+    Model* model = instance.mesh();
+    DrawCall draw(frame, zBuffer, model, shadow, mask);
+    if (pass == PASS_DEPTH)
+        draw.state = PipelineState(DEPTH_GREATER, true, false, BLEND_DISCARD, frame.get_bytespp());
+    else if (pass == PASS_SHADE_EQUAL)
+        draw.state.depthFunc = DEPTH_EQUAL;
+    TriangleFn raster = select_pipeline(draw);
+    ProjectedVertices vertices(instance);
+    if (!stats)
+    {
+        for (int i = 0; i < model->nfaces(); i++)
+            draw_face(vertices, i, pass, draw, raster);
+        return;
+    }
+
+    const std::vector<Meshlet>& meshlets = model->meshlets();
+    bool occlusion = pass == PASS_SHADE;
+    int count = (int)meshlets.size();
+    bool* kept = FrameArena::local().allocate<bool>(model->nfaces());
+    std::fill(kept, kept + model->nfaces(), false);
+
+    Vec3f lo, hi;
+    instance.bounds(lo, hi);
+    for (int k = 0; k < count; k++)
+    {
+        const Meshlet& meshlet = meshlets[k];
+        stats->meshlets++;
+        if (meshlet.coneAxis * view_dir < -meshlet.coneCutoff)
+        {
+            stats->backfacing++;
+            continue;
+        }
+        Vec3f screenLo, screenHi;
+        if (meshlet_screen_box(instance, meshlet, lo, hi, screenLo, screenHi))
+        {
+            if (screenHi.x <= -1 || screenHi.y <= -1 || screenLo.x >= width || screenLo.y >= height)
+            {
+                stats->offscreen++;
+                continue;
+            }
+            if (occlusion && box_occluded(screenLo, screenHi, zBuffer, width, height))
+            {
+                stats->occluded++;
+                continue;
+            }
+        }
+        for (int i = meshlet.first; i < meshlet.first + meshlet.count; i++)
+            kept[model->meshlet_face(i)] = true;
+        stats->fetched += meshlet.count;
+    }
+    for (int i = 0; i < model->nfaces(); i++)
+    {
+        if (kept[i])
+            draw_face(vertices, i, pass, draw, raster);
+    }
+    stats->faces += model->nfaces();
+}
+
+// pixel rectangle covered by the faces draw_instance would rasterize, clamped to just outside the screen
+BoundingBox screen_bounds(Instance& instance)
+{
+    BoundingBox bb{ Vec2f(width), Vec2f(-1) };
+    Model* model = instance.mesh();
+    for (int i = 0; i < model->nfaces(); i++)
+    {
+        Vec3f screen_coords[3];
+        Vec3f world_coords[3];
+        project_face(instance, i, world_coords, screen_coords);
+        if (!front_facing(world_coords))
+            continue;
+        for (int j = 0; j < 3; j++)
+        {
+            bb.lowerLeft.x = std::min(bb.lowerLeft.x, screen_coords[j].x);
+            bb.lowerLeft.y = std::min(bb.lowerLeft.y, screen_coords[j].y);
+            bb.upperRight.x = std::max(bb.upperRight.x, screen_coords[j].x);
+            bb.upperRight.y = std::max(bb.upperRight.y, screen_coords[j].y);
+        }
     }
+    bb.lowerLeft.x = std::max(std::floor(bb.lowerLeft.x), -1.f);
+    bb.lowerLeft.y = std::max(std::floor(bb.lowerLeft.y), -1.f);
+    bb.upperRight.x = std::min(std::ceil(bb.upperRight.x), (float)width);
+    bb.upperRight.y = std::min(std::ceil(bb.upperRight.y), (float)height);
+    return bb;
 }
 
-void line(Vec2i t0, Vec2i t1, TGAImage& image, TGAColor color)
+// overlay of every mesh edge, each shared edge drawn once, vertices projected once up front the same way
+// project_face does, so that the lines run along the shaded triangles
+void draw_wireframe(Instance& instance, TGAImage& frame, TGAColor color, bool antialiased)
 {
-    line(t0.x, t0.y, t1.x, t1.y, image, color);
+    Model* model = instance.mesh();
+    std::vector<Vec3f> screen_coords(model->nverts());
+    for (int i = 0; i < model->nverts(); i++)
+        screen_coords[i] = project(instance.world(i));
+
+    const std::vector<Vec2i>& edges = model->edges();
+    for (int i = 0; i < (int)edges.size(); i++)
+    {
+        Vec3f& a = screen_coords[edges[i].x];
+        Vec3f& b = screen_coords[edges[i].y];
+        if (antialiased)
+            line_aa(a.x, a.y, b.x, b.y, frame, color);
+        else
+            line(a.x, a.y, b.x, b.y, frame, color);
+    }
 }
 
-void triangle(Vec2i t0, Vec2i t1, Vec2i t2, TGAImage& image, TGAColor color)
+// out of core rendering: chunks are rasterized as they come in, the stream prefetches the next one meanwhile;
+// material only provides the texture
+long long draw_stream(MeshStream& stream, Model* material, TGAImage& frame, float zBuffer[])
 {
-    line(t0, t1, image, color);
-    line(t1, t2, image, color);
-    line(t2, t0, image, color);
+    long long drawn = 0;
+    DrawCall draw(frame, zBuffer, material);
+    TriangleFn raster = select_pipeline(draw);
+    const SoupTriangle* tris;
+    int count;
+    while (stream.next(tris, count))
+    {
+        for (int i = 0; i < count; i++)
+        {
+            Vec3f world_coords[3];
+            Vec3f screen_coords[3];
+            Vec2i uvs[3];
+            for (int j = 0; j < 3; j++)
+            {
+                const SoupVertex& v = tris[i].v[j];
+                world_coords[j] = Vec3f(v.x, v.y, v.z);
+                uvs[j] = Vec2i(v.u * material->texture_width(), v.v * material->texture_height());
+            }
+            project_vertices(world_coords, screen_coords);
+            if (!front_facing(world_coords))
+                continue;
+            raster(draw, screen_coords, uvs, NULL);
+        }
+        drawn += count;
+    }
+    return drawn;
 }
 
-Vec3f GetBarycentric(Vec3f point, Vec3f* t)
+// visible sample count of the instance's bounding box, 0 means the whole instance can be skipped
+int occlusion_query(Instance& instance, float zBuffer[])
 {
-    Vec2f AB = Vec2f(t[1].x, t[1].y) - Vec2f(t[0].x, t[0].y);
-    Vec2f AC = Vec2f(t[2].x, t[2].y) - Vec2f(t[0].x, t[0].y);
-    Vec2f PA = Vec2f(t[0].x, t[0].y) - Vec2f(point.x, point.y);
+    Vec3f lo, hi;
+    instance.bounds(lo, hi);
+    Vec3f corners[8];
+    for (int i = 0; i < 8; i++)
+        corners[i] = project(Vec3f(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z));
+    return occlusion_query(corners, zBuffer, width, height);
+}
 
-    Vec3f v1{ AB.x, AC.x, PA.x };
-    Vec3f v2{ AB.y, AC.y, PA.y };
+void write_frame(TGAImage output, const char* filename)
+{
+    output.flip_vertically(); // to place the origin in the bottom left corner of the image 
+    output.write_tga_file(filename);
+}
 
-    int crossZ = (v1.x * v2.y) - (v1.y * v2.x);
+// raster path options picked on the command line, shared by the local frame loop and render farm workers
+struct Settings
+{
+    bool shadows, zprepass, occlusion, fixedPoint, meshlets, tiled;
+    float lodError; // pixels a level of detail may be off on screen, 0 draws the full meshes
 
-    //point and t's has integers as coordinates, so abs(crossZ) < 1 means that crossZ is 0
-    //and thus triangle is degenerate
-    if (std::abs(crossZ) < 1)
-        return Vec3f(-1);
+    Settings() : shadows(false), zprepass(false), occlusion(false), fixedPoint(false), meshlets(false), tiled(false), lodError(0) {}
+};
 
-    float crossX = (v1.y * v2.z) - (v2.y * v1.z);
-    float crossY = (v2.x * v1.z) - (v1.x * v2.z);
+// coarsest level of detail of the instance whose error, scaled by the projection at the instance's nearest
+// point, stays within maxError pixels
+int select_lod(Instance& instance, float maxError)
+{
+    Model* model = instance.model;
+    if (maxError <= 0 || model->nlods() == 1)
+        return 0;
+    Vec3f lo, hi;
+    instance.bounds(lo, hi);
+    float w = 1 - hi.z / camera.z; // the perspective divide of project_vertices
+    if (w <= 0)
+        return 0;
+    float pixels = instance.scale * width / 2 / w;
+    int lod = 0;
+    while (lod + 1 < model->nlods() && model->lod(lod + 1)->lod_error() * pixels <= maxError)
+        lod++;
+    return lod;
+}
 
-    return Vec3f{ 1 - (crossX + crossY) / crossZ, crossX / crossZ, crossY / crossZ };
+// to be called whenever an instance moves: picks its level of detail anew and returns its new screen rectangle
+BoundingBox place_instance(Instance& instance, const Settings& settings)
+{
+    instance.lod = select_lod(instance, settings.lodError);
+    return screen_bounds(instance);
 }
 
-struct BoundingBox
+struct FrameStats
 {
-    Vec2f lowerLeft;
-    Vec2f upperRight;
+    int visible, culled;
+    MeshletStats meshlets;
+
+    FrameStats() : visible(0), culled(0) {}
 };
 
-void filled_triangle(Vec3f* t, TGAImage& image, Vec2i* uvs, Model* model, float zBuffer[])
+// clears the dirty tiles of the frame and draws into them the instances whose bounds reach them;
+// order is the submission order, bounds the screen rectangle of every instance
+void draw_scene(std::vector<Instance>& scene, const std::vector<int>& order, const std::vector<BoundingBox>& bounds,
+                const Settings& settings, ShadowMap& shadowMap, DirtyTiles& dirty, DirtyTiles& changed, TGAImage& frame,
+                FrameStats& stats)
 {
-    BoundingBox bb{ Vec2f(std::numeric_limits<float>::max()), Vec2f(-std::numeric_limits<float>::max()) };
-    for (int i = 0; i < 3; i++)
+    if (settings.fixedPoint)
+        dirty.clear(frame, zBufferFixed, std::numeric_limits<int>::min());
+    else if (settings.tiled)
+        tileBuffer.clear(dirty);
+    else
+        dirty.clear(frame, zBuffer, -std::numeric_limits<float>::max());
+    const DirtyTiles* mask = dirty.all() ? NULL : &dirty;
+
+    int* visible = FrameArena::local().allocate<int>(order.size());
+    int nvisible = 0;
+    for (int k = 0; k < (int)order.size(); k++)
     {
-        Vec3f vert = t[i];
-        if (bb.lowerLeft.x > vert.x)
-            bb.lowerLeft.x = vert.x;
-        if (bb.lowerLeft.y > vert.y)
-            bb.lowerLeft.y = vert.y;
-        if (bb.upperRight.x < vert.x)
-            bb.upperRight.x = vert.x;
-        if (bb.upperRight.y < vert.y)
-            bb.upperRight.y = vert.y;
+        const BoundingBox& bb = bounds[order[k]];
+        if (dirty.any(bb.lowerLeft.x, bb.lowerLeft.y, bb.upperRight.x, bb.upperRight.y))
+            visible[nvisible++] = order[k];
     }
+    stats.visible = nvisible;
 
-    int colNum = bb.upperRight.x - bb.lowerLeft.x;
-    int rowNum = bb.upperRight.y - bb.lowerLeft.y;
-    int pixNum = colNum * rowNum;
-
-    for (int i = 0; i < pixNum; i++)
+    MeshletStats* meshletStats = settings.meshlets ? &stats.meshlets : NULL;
+    if (settings.zprepass)
     {
-        Vec3f pix{ (i % colNum) + bb.lowerLeft.x, (i / colNum) + bb.lowerLeft.y, 0/*sum of top's z times corresponding barycentric coord*/ };
-        Vec3f barycentric = GetBarycentric(pix, t);
-        if (barycentric.x < 0 || barycentric.y < 0 || barycentric.z < 0)
+        for (int k = 0; k < nvisible; k++)
+            draw_instance(scene[visible[k]], PASS_DEPTH, frame, zBuffer, NULL, mask, meshletStats);
+    }
+    for (int k = 0; k < nvisible; k++)
+    {
+        // after a pre-pass the z buffer already holds the instance itself, a query would always fail
+        if (settings.occlusion && !settings.zprepass && occlusion_query(scene[visible[k]], zBuffer) == 0)
+        {
+            stats.culled++;
             continue;
+        }
+        Pass pass = settings.fixedPoint ? PASS_SHADE_FIXED : settings.tiled ? PASS_SHADE_TILED : settings.zprepass ? PASS_SHADE_EQUAL : PASS_SHADE;
+        draw_instance(scene[visible[k]], pass, frame, zBuffer, settings.shadows ? &shadowMap : NULL, mask, meshletStats);
+    }
 
-        for (int j = 0; j < 3; j++)
-            pix.z += barycentric[j] * t[j].z;
-
-        int zBufferIndex = pix.x + width * pix.y;
-        if (zBufferIndex < 0 || zBufferIndex >= pixCount)
-            continue;
+    if (settings.tiled)
+    {
+        changed.reset();
+        tileBuffer.resolve(frame, &changed);
+    }
+}
 
-        if (zBuffer[zBufferIndex] >= pix.z)
+// --bench-pipelines N: draws the instance N times in each pipeline state below, through the loop
+// select_pipeline picks for the state and through the general loop, and reports the fastest run of either;
+// faces are projected up front so that only rasterization is timed
+void bench_pipelines(Instance& instance, ShadowMap& shadowMap, int repeats)
+{
+    struct Case
+    {
+        const char* name;
+        PipelineState state;
+        bool shadow;
+    };
+    const Case cases[] = {
+        { "shade", PipelineState(), false },
+        { "shade with shadows", PipelineState(), true },
+        { "shade after pre-pass", PipelineState(DEPTH_EQUAL, false), false },
+        { "flat color", PipelineState(DEPTH_GREATER, true, false), false },
+        { "depth only", PipelineState(DEPTH_GREATER, true, false, BLEND_DISCARD), false },
+        { "additive", PipelineState(DEPTH_ALWAYS, false, true, BLEND_ADD), false },
+        { "alpha", PipelineState(DEPTH_GREATER, false, true, BLEND_ALPHA), false },
+        { "rgba", PipelineState(DEPTH_GREATER, true, true, BLEND_REPLACE, TGAImage::RGBA), false },
+        { "grayscale", PipelineState(DEPTH_GREATER, true, true, BLEND_REPLACE, TGAImage::GRAYSCALE), false },
+    };
+
+    Model* model = instance.mesh();
+    std::vector<Vec3f> screen, light;
+    std::vector<Vec2i> uvs;
+    for (int i = 0; i < model->nfaces(); i++)
+    {
+        Vec3f screen_coords[3];
+        Vec3f world_coords[3];
+        project_face(instance, i, world_coords, screen_coords);
+        if (!front_facing(world_coords))
             continue;
+        for (int j = 0; j < 3; j++)
+        {
+            screen.push_back(screen_coords[j]);
+            uvs.push_back(model->uv(i, j));
+            light.push_back(shadowMap.to_light(world_coords[j]));
+        }
+    }
+    int faces = (int)screen.size() / 3;
 
-        Vec2i uv;
-        uv += uvs[0] * barycentric[0];
-        uv += uvs[1] * barycentric[1];
-        uv += uvs[2] * barycentric[2];
+    // the z buffer the equal test runs against
+    std::vector<float> prepass(pixCount, -std::numeric_limits<float>::max());
+    for (int i = 0; i < faces; i++)
+        depth_triangle(&screen[i * 3], &prepass[0], width, height);
 
-        zBuffer[zBufferIndex] = pix.z;
-        image.set(pix.x, pix.y, model->diffuse(uv));
+    std::cerr << "pipelines: " << faces << " faces, best of " << repeats << std::endl;
+    for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++)
+    {
+        const Case& test = cases[c];
+        TGAImage images[2] = { TGAImage(width, height, test.state.bytespp), TGAImage(width, height, test.state.bytespp) };
+        std::vector<float> depth(pixCount);
+        double best[2];
+        for (int k = 0; k < 2; k++)
+        {
+            DrawCall draw(images[k], &depth[0], model, test.shadow ? &shadowMap : NULL);
+            draw.state = test.state;
+            draw.color = TGAColor(200, 180, 160, 255);
+            draw.opacity = 128;
+            TriangleFn raster = k == 0 ? select_pipeline(draw) : filled_triangle_general;
+            best[k] = std::numeric_limits<double>::max();
+            for (int r = 0; r < repeats; r++)
+            {
+                images[k].clear();
+                if (test.state.depthFunc == DEPTH_EQUAL)
+                    depth = prepass;
+                else
+                    std::fill(depth.begin(), depth.end(), -std::numeric_limits<float>::max());
+
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (int i = 0; i < faces; i++)
+                    raster(draw, &screen[i * 3], &uvs[i * 3], &light[i * 3]);
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                best[k] = std::min(best[k], elapsed.count());
+            }
+        }
+        bool same = !memcmp(images[0].buffer(), images[1].buffer(), (size_t)pixCount * test.state.bytespp);
+        std::cerr << "  " << test.name << ": specialized " << best[0] << " ms, general " << best[1] << " ms ("
+                  << best[1] / best[0] << "x)" << (same ? "" : ", outputs differ") << std::endl;
     }
 }
 
-Vec3f world2screen(Vec3f v)
+// placement of every instance for the render farm, in the frame arena
+InstanceState* instance_states(std::vector<Instance>& scene)
 {
-    return Vec3f(int((v.x + 1.) * width / 2. + .5), int((v.y + 1.) * height / 2. + .5), v.z);
+    InstanceState* states = FrameArena::local().allocate<InstanceState>(scene.size());
+    for (int k = 0; k < (int)scene.size(); k++)
+    {
+        for (int j = 0; j < 3; j++)
+            states[k].offset[j] = scene[k].offset.raw[j];
+        states[k].scale = scene[k].scale;
+    }
+    return states;
 }
 
 int main(int argc, char** argv)
 {
+    Settings settings;
+    bool incremental = false;
+    bool wireframe = false;
+    bool wireframeAA = false;
+    bool compressTextures = false;
+    bool checkAllocations = false;
+    int heads = 1;
+    int frames = 1;
+    int benchRepeats = 0;
+    int workers = 0;
+    int servePort = 0;
+    std::vector<std::string> remotes;
+    const char* patchFile = NULL;
+    const char* streamFile = NULL;
+    std::vector<Vec2i> thumbnails;
+    ResampleOptions thumbnailOptions;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--shadows"))
+            settings.shadows = true;
+        else if (!strcmp(argv[i], "--zprepass"))
+            settings.zprepass = true;
+        else if (!strcmp(argv[i], "--occlusion"))
+            settings.occlusion = true;
+        else if (!strcmp(argv[i], "--heads") && i + 1 < argc)
+            heads = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--incremental"))
+            incremental = true;
+        else if (!strcmp(argv[i], "--fixed"))
+            settings.fixedPoint = true;
+        else if (!strcmp(argv[i], "--bc1"))
+            compressTextures = true;
+        else if (!strcmp(argv[i], "--tiled"))
+            settings.tiled = true;
+        else if (!strcmp(argv[i], "--tile-size") && i + 1 < argc)
+        {
+            // the tiles have to nest in the 32 pixel tiles the frame is invalidated by
+            int size = atoi(argv[++i]);
+            if (size > 0 && 32 % size == 0)
+                tileBuffer = TileBuffer(width, height, TGAImage::RGB, -std::numeric_limits<float>::max(), size);
+            else
+                std::cerr << "tile size " << size << " does not divide 32, using 32" << std::endl;
+        }
+        else if (!strcmp(argv[i], "--meshlets"))
+            settings.meshlets = true;
+        else if (!strcmp(argv[i], "--lod") && i + 1 < argc)
+            settings.lodError = std::max(0.f, (float)atof(argv[++i]));
+        else if (!strcmp(argv[i], "--bench-pipelines") && i + 1 < argc)
+            benchRepeats = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--check-allocations"))
+            count_heap_allocations(checkAllocations = true);
+        else if (!strcmp(argv[i], "--wireframe"))
+            wireframe = true;
+        else if (!strcmp(argv[i], "--wireframe-aa"))
+            wireframe = wireframeAA = true;
+        else if (!strcmp(argv[i], "--patches") && i + 1 < argc)
+            patchFile = argv[++i];
+        else if (!strcmp(argv[i], "--stream") && i + 1 < argc)
+            streamFile = argv[++i];
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc)
+            workers = std::max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--remote") && i + 1 < argc)
+            remotes.push_back(argv[++i]);
+        else if (!strcmp(argv[i], "--serve") && i + 1 < argc)
+            servePort = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--thumbnails") && i + 1 < argc)
+        {
+            // comma separated widths, heights follow the aspect of the frame
+            for (char* p = argv[++i]; *p; p += *p == ',')
+            {
+                int w = std::max(1, (int)strtol(p, &p, 10));
+                thumbnails.push_back(Vec2i(w, std::max(1, w * height / width)));
+                if (*p && *p != ',')
+                    break;
+            }
+        }
+        else if (!strcmp(argv[i], "--thumbnail-filter") && i + 1 < argc)
+        {
+            const char* name = argv[++i];
+            if (!strcmp(name, "box"))
+                thumbnailOptions.filter = FILTER_BOX;
+            else if (!strcmp(name, "bilinear"))
+                thumbnailOptions.filter = FILTER_BILINEAR;
+            else if (!strcmp(name, "lanczos3"))
+                thumbnailOptions.filter = FILTER_LANCZOS3;
+            else
+                std::cerr << "unknown filter " << name << ", using lanczos3" << std::endl;
+        }
+        else if (!strcmp(argv[i], "--thumbnail-gamma"))
+            thumbnailOptions.gamma = true;
+        else if (!strcmp(argv[i], "--convert") && i + 2 < argc)
+            return MeshStream::convert_obj(argv[i + 1], argv[i + 2]) ? 0 : 1;
+        else if (!strcmp(argv[i], "--light") && i + 3 < argc)
+        {
+            light_dir = Vec3f(atof(argv[i + 1]), atof(argv[i + 2]), atof(argv[i + 3]));
+            i += 3;
+        }
+    }
+
+    // the integer rasterizer has its own z buffer and no shadow or pre-pass support
+    if (settings.fixedPoint && (settings.shadows || settings.zprepass || settings.occlusion))
+    {
+        std::cerr << "--fixed ignores --shadows, --zprepass and --occlusion" << std::endl;
+        settings.shadows = settings.zprepass = settings.occlusion = false;
+    }
+    // the tile buffer has no flat z buffer for the pre-pass and the queries to read
+    if (settings.fixedPoint && settings.tiled)
+    {
+        std::cerr << "--fixed ignores --tiled" << std::endl;
+        settings.tiled = false;
+    }
+    if (settings.tiled && (settings.zprepass || settings.occlusion))
+    {
+        std::cerr << "--tiled ignores --zprepass and --occlusion" << std::endl;
+        settings.zprepass = settings.occlusion = false;
+    }
+    // workers redraw their whole band every frame
+    if ((workers || !remotes.empty()) && incremental)
+    {
+        std::cerr << "--workers and --remote ignore --incremental" << std::endl;
+        incremental = false;
+    }
+
     TGAImage frame(width, height, TGAImage::RGB);
 
-    for (int i = 0; i < pixCount; i++)
-        zBuffer[i] = -std::numeric_limits<float>::max();
-    
     Matrix Projection = Matrix::identity(4);
     Projection[3][2] = -1.f / camera.z;
     Matrix ViewPort = viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
+    (void)ViewPort; // only the matrix path commented out in project_vertices uses it
 
-    model = new Model("obj/african_head.obj");
+    AssetCache assets;
+    // --bc1 keeps diffuse maps block compressed and decodes them while sampling
+    assets.set_texture_compression(compressTextures);
+    // --lod PIXELS simplifies the mesh into levels of detail and draws each instance at the coarsest one
+    // that is off by at most that many pixels
+    assets.set_lod_generation(settings.lodError > 0);
 
-    for (int i = 0; i < model->nfaces(); i++)
+    // --stream renders an .obj or a triangle soup written by --convert without ever loading it whole
+    if (streamFile)
     {
-        std::vector<int> face = model->face(i);
-        Vec3f screen_coords[3];
-        Vec3f world_coords[3];
-        for (int j = 0; j < 3; j++) {
-            world_coords[j] = model->vert(face[j]);
-            //screen_coords[j] = m2v(ViewPort * Projection * v2m(world_coords[j]));
-            screen_coords[j] = world2screen(world_coords[j]);
+        MeshStream stream(streamFile);
+        if (!stream.is_open())
+            return 1;
+        std::shared_ptr<Model> material = compressTextures ? std::make_shared<Model>(assets.block_texture(stream.texture(), true))
+                                                           : std::make_shared<Model>(assets.texture(stream.texture(), true));
+        for (int i = 0; i < pixCount; i++)
+            zBuffer[i] = -std::numeric_limits<float>::max();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        long long drawn = draw_stream(stream, material.get(), frame, zBuffer);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "stream: " << drawn << " triangles in " << elapsed.count() << " ms" << std::endl;
+
+        write_frame(frame, "framebuffer.tga");
+        return 0;
+    }
+
+    std::shared_ptr<Model> model = assets.model("obj/african_head.obj");
+    if (compressTextures)
+        std::cerr << "assets: " << assets.memory_usage() << " bytes" << std::endl;
+
+    // --heads N stacks copies of the head behind each other, submitted back to front: the worst case for overdraw
+    std::vector<Instance> scene;
+    for (int k = heads - 1; k >= 0; k--)
+        scene.push_back(Instance(model.get(), Vec3f(.05f * k, .02f * k, -.3f * k)));
+
+    ShadowMap shadowMap(shadowMapSize, light_dir);
+    if (settings.shadows)
+        shadowMap.render(scene);
+
+    // occlusion culling only pays off front to back, so that the occluders are already in the z buffer
+    std::vector<int> order;
+    for (int k = 0; k < (int)scene.size(); k++)
+        order.push_back(settings.occlusion ? (int)scene.size() - 1 - k : k);
+
+    // --frames N slides the front head to the right a bit every frame; with --incremental color and depth are
+    // kept between frames and only the tiles under the old and the new position of the head are redrawn
+    DirtyTiles dirty(width, height);
+    DirtyTiles changed(width, height); // tiles a tiled frame actually resolved, only those get encoded
+    std::vector<BoundingBox> bounds;
+    for (int k = 0; k < (int)scene.size(); k++)
+        bounds.push_back(place_instance(scene[k], settings));
+
+    if (benchRepeats)
+    {
+        if (!settings.shadows)
+            shadowMap.render(scene);
+        bench_pipelines(scene.back(), shadowMap, benchRepeats);
+        return 0;
+    }
 
-            screen_coords->x /= 1 - (screen_coords->z / 3);
-            screen_coords->y /= 1 - (screen_coords->z / 3);
-            screen_coords->z /= 1 - (screen_coords->z / 3);
+    // a worker process brings its scene to the state the coordinator sends and draws just the rows asked for
+    DirtyTiles band(width, height);
+    RenderFarm::RenderFn renderBand = [&](const RegionJob& job, const InstanceState* states)
+    {
+        if (job.instances != (int)scene.size())
+        {
+            std::cerr << "coordinator sent " << job.instances << " instances, the worker has " << scene.size()
+                      << " (the same --heads is needed on both sides)" << std::endl;
+            return false;
         }
-        Vec3f n = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
-        n.normalize();
-        float intensity = n * light_dir;
-        if (intensity > 0)
+        for (int k = 0; k < (int)scene.size(); k++)
         {
-            Vec2i uvs[3];
-            for (int j = 0; j < 3; j++)
-                uvs[j] = model->uv(i, j);
-            filled_triangle(screen_coords, frame, uvs, model, zBuffer);
+            scene[k].offset = Vec3f(states[k].offset[0], states[k].offset[1], states[k].offset[2]);
+            scene[k].scale = states[k].scale;
+            bounds[k] = place_instance(scene[k], settings);
         }
-    }
+        if (settings.shadows)
+            shadowMap.render(scene);
+        band.reset();
+        band.mark(0, job.y0, width - 1, job.y1 - 1);
+        FrameStats stats;
+        draw_scene(scene, order, bounds, settings, shadowMap, band, changed, frame, stats);
+        return true;
+    };
+    // --serve PORT turns this process into a remote worker for a coordinator started with --remote
+    if (servePort)
+        return RenderFarm::serve_tcp(servePort, frame, renderBand) ? 0 : 1;
+
+    // --workers N forks local workers, --remote HOST:PORT adds one started elsewhere with --serve
+    RenderFarm farm(width, height);
+    if (workers)
+        farm.spawn(workers, frame, renderBand);
+    for (int i = 0; i < (int)remotes.size(); i++)
+        farm.connect(remotes[i]);
+
+    std::ofstream patches;
+    if (patchFile)
+        patches.open(patchFile, std::ios::binary);
+
+    // transient data of a frame comes from the arena and goes away with it at the end of the frame; with
+    // --check-allocations any frame after the first that still allocates on the heap is an error
+    FrameArena& arena = FrameArena::local();
+    for (int f = 0; f < frames; f++, arena.reset())
+    {
+        unsigned long long allocations = heap_allocations();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        dirty.mark_all();
+        if (f > 0)
+        {
+            BoundingBox before = bounds.back();
+            scene.back().offset.x += .02f;
+            bounds.back() = place_instance(scene.back(), settings);
+            // a moving shadow caster may change lighting anywhere on screen
+            if (incremental && !settings.shadows)
+            {
+                dirty.reset();
+                dirty.mark(before.lowerLeft.x, before.lowerLeft.y, before.upperRight.x, before.upperRight.y);
+                dirty.mark(bounds.back().lowerLeft.x, bounds.back().lowerLeft.y, bounds.back().upperRight.x, bounds.back().upperRight.y);
+            }
+        }
+
+        FrameStats stats;
+        bool distributed = farm.size() > 0 && farm.render(f, instance_states(scene), (int)scene.size(), frame);
+        if (!distributed)
+        {
+            if (f > 0 && settings.shadows)
+                shadowMap.render(scene);
+            draw_scene(scene, order, bounds, settings, shadowMap, dirty, changed, frame, stats);
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "frame: " << elapsed.count() << " ms";
+        if (distributed)
+        {
+            std::cerr << ", bands";
+            for (int i = 0; i < farm.size(); i++)
+            {
+                int y0, y1;
+                double ms;
+                farm.band(i, y0, y1, ms);
+                std::cerr << " " << y0 << "-" << y1 << ":" << ms << "ms";
+            }
+        }
+        else
+        {
+            if (frames > 1)
+                std::cerr << ", " << dirty.count() << " dirty tiles";
+            if (settings.occlusion)
+                std::cerr << ", " << stats.culled << "/" << stats.visible << " instances occluded";
+            if (settings.lodError > 0)
+            {
+                long long faces = 0;
+                std::cerr << ", lods";
+                for (int k = 0; k < (int)scene.size(); k++)
+                {
+                    std::cerr << " " << scene[k].lod;
+                    faces += scene[k].mesh()->nfaces();
+                }
+                std::cerr << ", " << faces << " faces";
+            }
+            if (settings.meshlets)
+                std::cerr << ", meshlets " << stats.meshlets.offscreen << " offscreen " << stats.meshlets.backfacing << " backfacing "
+                          << stats.meshlets.occluded << " occluded of " << stats.meshlets.meshlets << ", "
+                          << stats.meshlets.fetched << "/" << stats.meshlets.faces << " faces fetched";
+            if (settings.tiled)
+                std::cerr << ", tiles " << tileBuffer.count_color(TileBuffer::TILE_CONSTANT) << " constant "
+                          << tileBuffer.count_color(TileBuffer::TILE_RAW) << " raw color, "
+                          << tileBuffer.count_depth(TileBuffer::TILE_PLANE) << " plane "
+                          << tileBuffer.count_depth(TileBuffer::TILE_RAW) << " raw depth, "
+                          << changed.count() << " resolved";
+        }
+        std::cerr << std::endl;
 
-    frame.flip_vertically(); // to place the origin in the bottom left corner of the image 
-    frame.write_tga_file("framebuffer.tga");
+        if (patches.is_open())
+            (settings.tiled && !distributed ? changed : dirty).write_patch(patches, frame, f);
 
-    delete model;
+        if (checkAllocations)
+        {
+            allocations = heap_allocations() - allocations;
+            std::cerr << "frame " << f << ": " << allocations << " heap allocations, " << arena.used() << " arena bytes" << std::endl;
+            if (f > 0 && allocations > 0)
+            {
+                std::cerr << "frame " << f << " allocated on the heap" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // the overlay goes onto the written copy only, incremental frames keep the shaded pixels underneath
+    TGAImage output(frame);
+    if (wireframe)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int k = 0; k < (int)scene.size(); k++)
+            draw_wireframe(scene[k], output, green, wireframeAA);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "wireframe: " << elapsed.count() << " ms" << std::endl;
+    }
+    // --thumbnails W,W,... writes downscaled copies of the written image, all sizes made in one go
+    if (!thumbnails.empty())
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<TGAImage> images;
+        if (resample(output, thumbnails, images, thumbnailOptions))
+        {
+            for (int k = 0; k < (int)images.size(); k++)
+            {
+                std::string name = "thumbnail_" + std::to_string(thumbnails[k].x) + "x" + std::to_string(thumbnails[k].y) + ".tga";
+                write_frame(std::move(images[k]), name.c_str());
+            }
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "thumbnails: " << elapsed.count() << " ms" << std::endl;
+    }
+    write_frame(std::move(output), "framebuffer.tga");
 
     //getchar();
 
     return 0;
 }
-
@@ -1,11 +1,20 @@
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <limits>
 #include "model.h"
+#include "assets.h"
+#include "blocktexture.h"
+#include "simplify.h"
 
-Model::Model(const char *filename) : verts_(), faces_() {
+static const char LOD_MAGIC[4] = { 'L', 'O', 'D', 'S' };
+static const int LOD_VERSION = 2; // 2: errors are the furthest distance to the original faces
+
+Model::Model(const char *filename, AssetCache* assets) : verts_(), faces_(), base_(NULL), diffusemap_(std::make_shared<TGAImage>()), lodError_(0) {
     std::ifstream in;
     in.open (filename, std::ifstream::in);
     if (in.fail()) return;
@@ -38,45 +47,375 @@ Model::Model(const char *filename) : verts_(), faces_() {
         }
     }
     std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << std::endl;
-    load_texture(filename, "_diffuse.tga", diffusemap_);
+    build_meshlets();
+    load_texture(filename, "_diffuse.tga", diffusemap_, assets);
+}
+
+// texture only, for geometry that is streamed in from elsewhere
+Model::Model(std::shared_ptr<TGAImage> diffusemap) : verts_(), faces_(), base_(NULL), diffusemap_(diffusemap), lodError_(0) {
+}
+
+Model::Model(std::shared_ptr<BlockTexture> blockmap) : verts_(), faces_(), base_(NULL), diffusemap_(std::make_shared<TGAImage>()), blockmap_(blockmap),
+    lodError_(0) {
+}
+
+// level of detail of base: the faces of the level over base's vertices, uvs and textures, which stay base's
+Model::Model(Model& base, const LodLevel& level) : verts_(), faces_(level.faces), uv_(), base_(&base),
+    diffusemap_(base.diffusemap_), blockmap_(base.blockmap_), lodError_(level.error) {
+    build_meshlets();
 }
 
 Model::~Model() {
 }
 
 int Model::nverts() {
-    return (int)verts_.size();
+    return (int)verts().size();
 }
 
 int Model::nfaces() {
     return (int)faces_.size();
 }
 
-std::vector<int> Model::face(int idx) {
-    std::vector<int> face;
-    for (int i = 0; i < (int)faces_[idx].size(); i++) face.push_back(faces_[idx][i][0]);
-    return face;
+// geometry only, the diffuse map is accounted for by whoever owns it; a level of detail has no vertices or uvs
+// of its own, so only its faces and meshlets count
+size_t Model::memory_usage() {
+    size_t bytes = verts_.capacity() * sizeof(Vec3f) + uv_.capacity() * sizeof(Vec2f);
+    bytes += meshlets_.capacity() * sizeof(Meshlet) + meshletFaces_.capacity() * sizeof(int);
+    for (int i = 0; i < (int)faces_.size(); i++)
+        bytes += faces_[i].capacity() * sizeof(Vec3i);
+    for (int i = 0; i < (int)lods_.size(); i++)
+        bytes += lods_[i]->memory_usage();
+    return bytes + faces_.capacity() * sizeof(std::vector<Vec3i>);
+}
+
+// vertex index of a face corner, straight from the face list
+int Model::face_vert(int iface, int nvert) {
+    return faces_[iface][nvert][0];
+}
+
+// every edge of the mesh once, as a pair of vertex indices with the smaller one first;
+// built on first use, since only the wireframe overlay needs it
+const std::vector<Vec2i>& Model::edges() {
+    std::call_once(edgesOnce_, [this]() {
+        std::vector<std::pair<int, int> > pairs;
+        for (int i = 0; i < (int)faces_.size(); i++) {
+            int n = (int)faces_[i].size();
+            for (int j = 0; j < n; j++) {
+                int a = faces_[i][j][0], b = faces_[i][(j + 1) % n][0];
+                pairs.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        edges_.reserve(pairs.size());
+        for (int i = 0; i < (int)pairs.size(); i++)
+            edges_.push_back(Vec2i(pairs[i].first, pairs[i].second));
+    });
+    return edges_;
+}
+
+// greedy clustering: a meshlet of up to 128 faces starts at the first face not yet taken and grows across shared vertices,
+// always taking the candidate closest to its centroid, weighted by how far its normal strays from the
+// cluster's average normal so that the cones stay narrow. Clusters that run out of candidates early, the
+// leftovers between full ones, are merged into their smallest neighbour afterwards.
+void Model::build_meshlets() {
+    const int maxFaces = 128;
+    const int minFaces = maxFaces / 4; // smaller clusters get merged, which may take a neighbour up to maxFaces + minFaces
+    int n = (int)faces_.size();
+    const std::vector<Vec3f>& verts = this->verts();
+    std::vector<std::vector<int> > vertFaces(verts.size());
+    std::vector<Vec3f> centroids(n), normals(n);
+    for (int i = 0; i < n; i++) {
+        int m = (int)faces_[i].size();
+        for (int j = 0; j < m; j++) {
+            vertFaces[faces_[i][j][0]].push_back(i);
+            centroids[i] = centroids[i] + verts[faces_[i][j][0]] * (1.f / m);
+        }
+        // same winding as the renderer's facing test; degenerate faces are never drawn and get no normal
+        if (m < 3) continue;
+        Vec3f v0 = verts[faces_[i][0][0]], v1 = verts[faces_[i][1][0]], v2 = verts[faces_[i][2][0]];
+        Vec3f normal = (v2 - v0) ^ (v1 - v0);
+        if (normal.norm() > 0) normals[i] = normal.normalize();
+    }
+
+    std::vector<int> owner(n, -1);   // cluster a face went to, or is a candidate of
+    std::vector<bool> used(n, false);
+    std::vector<std::vector<int> > clusters;
+    for (int seed = 0; seed < n; seed++) {
+        if (used[seed]) continue;
+        int id = (int)clusters.size();
+        clusters.push_back(std::vector<int>());
+        std::vector<int>& cluster = clusters.back();
+        Vec3f centroidSum, normalSum;
+        std::vector<int> candidates(1, seed);
+        owner[seed] = id;
+        while (!candidates.empty() && (int)cluster.size() < maxFaces) {
+            int best = 0;
+            int count = (int)cluster.size();
+            if (count) {
+                Vec3f center = centroidSum * (1.f / count);
+                Vec3f axis = normalSum.norm() > 0 ? normalSum * (1.f / normalSum.norm()) : Vec3f();
+                float bestScore = std::numeric_limits<float>::max();
+                for (int k = 0; k < (int)candidates.size(); k++) {
+                    int f = candidates[k];
+                    float score = (centroids[f] - center).norm() * (1.f + 4.f * (1.f - normals[f] * axis));
+                    if (score < bestScore) {
+                        bestScore = score;
+                        best = k;
+                    }
+                }
+            }
+            int face = candidates[best];
+            candidates[best] = candidates.back();
+            candidates.pop_back();
+            used[face] = true;
+            cluster.push_back(face);
+            centroidSum = centroidSum + centroids[face];
+            normalSum = normalSum + normals[face];
+            for (int j = 0; j < (int)faces_[face].size(); j++) {
+                const std::vector<int>& around = vertFaces[faces_[face][j][0]];
+                for (int k = 0; k < (int)around.size(); k++) {
+                    if (used[around[k]] || owner[around[k]] == id) continue;
+                    owner[around[k]] = id;
+                    candidates.push_back(around[k]);
+                }
+            }
+        }
+    }
+
+    // a small cluster goes to the smallest cluster it shares a vertex with, as long as that stays in bounds
+    for (int c = 0; c < (int)clusters.size(); c++) {
+        int size = (int)clusters[c].size();
+        if (!size || size >= minFaces) continue;
+        int target = -1;
+        for (int k = 0; k < size; k++) {
+            int face = clusters[c][k];
+            for (int j = 0; j < (int)faces_[face].size(); j++) {
+                const std::vector<int>& around = vertFaces[faces_[face][j][0]];
+                for (int a = 0; a < (int)around.size(); a++) {
+                    int d = owner[around[a]];
+                    if (d == c || size + (int)clusters[d].size() > maxFaces + minFaces) continue;
+                    if (target < 0 || clusters[d].size() < clusters[target].size()) target = d;
+                }
+            }
+        }
+        if (target < 0) continue;
+        for (int k = 0; k < size; k++)
+            owner[clusters[c][k]] = target;
+        clusters[target].insert(clusters[target].end(), clusters[c].begin(), clusters[c].end());
+        clusters[c].clear();
+    }
+
+    for (int c = 0; c < (int)clusters.size(); c++) {
+        if (clusters[c].empty()) continue;
+        Meshlet meshlet;
+        meshlet.first = (int)meshletFaces_.size();
+        meshlet.count = (int)clusters[c].size();
+        meshletFaces_.insert(meshletFaces_.end(), clusters[c].begin(), clusters[c].end());
+        Vec3f normalSum;
+        for (int k = 0; k < meshlet.count; k++)
+            normalSum = normalSum + normals[clusters[c][k]];
+
+        Vec3f lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+        for (int k = meshlet.first; k < meshlet.first + meshlet.count; k++) {
+            for (int j = 0; j < (int)faces_[meshletFaces_[k]].size(); j++) {
+                Vec3f v = verts[faces_[meshletFaces_[k]][j][0]];
+                for (int c = 0; c < 3; c++) {
+                    lo.raw[c] = std::min(lo.raw[c], v.raw[c]);
+                    hi.raw[c] = std::max(hi.raw[c], v.raw[c]);
+                }
+            }
+        }
+        meshlet.center = (lo + hi) * .5f;
+        meshlet.radius = 0;
+        for (int k = meshlet.first; k < meshlet.first + meshlet.count; k++)
+            for (int j = 0; j < (int)faces_[meshletFaces_[k]].size(); j++)
+                meshlet.radius = std::max(meshlet.radius, (verts[faces_[meshletFaces_[k]][j][0]] - meshlet.center).norm());
+
+        // half angle of the normal cone from the normal furthest from the axis; the cluster can only be
+        // rejected when the view direction is more than 90 degrees plus that angle away from the axis,
+        // i.e. axis * d < -sin(angle). A small margin keeps the test conservative under rounding.
+        meshlet.coneAxis = Vec3f();
+        meshlet.coneCutoff = 1.f;
+        if (normalSum.norm() > 0) {
+            meshlet.coneAxis = normalSum * (1.f / normalSum.norm());
+            float minDot = 1.f;
+            for (int k = meshlet.first; k < meshlet.first + meshlet.count; k++) {
+                Vec3f normal = normals[meshletFaces_[k]];
+                if (normal.norm() > 0)
+                    minDot = std::min(minDot, normal * meshlet.coneAxis);
+            }
+            if (minDot > 0)
+                meshlet.coneCutoff = std::min(1.f, std::sqrt(std::max(0.f, 1.f - minDot * minDot)) + 1e-3f);
+        }
+        meshlets_.push_back(meshlet);
+    }
+}
+
+const std::vector<Meshlet>& Model::meshlets() {
+    return meshlets_;
+}
+
+int Model::meshlet_face(int i) {
+    return meshletFaces_[i];
+}
+
+// levels of detail of the mesh, read back from cacheFile when they were made from the same mesh (source
+// identifies it), simplified and written there otherwise
+bool Model::build_lods(const std::string& cacheFile, unsigned long long source) {
+    std::vector<LodLevel> levels;
+    if (!read_lod_file(cacheFile, source, levels)) {
+        levels = simplify(verts_, faces_);
+        write_lod_file(cacheFile, source, levels);
+    }
+    lods_.clear();
+    for (int i = 0; i < (int)levels.size(); i++)
+        lods_.push_back(std::shared_ptr<Model>(new Model(*this, levels[i])));
+    std::cerr << "# lods";
+    for (int i = 0; i < (int)lods_.size(); i++)
+        std::cerr << " f# " << lods_[i]->nfaces() << " e " << lods_[i]->lod_error();
+    std::cerr << std::endl;
+    return !lods_.empty();
+}
+
+// false when the file is missing, damaged or was made from another mesh than source
+bool Model::read_lod_file(const std::string& filename, unsigned long long source, std::vector<LodLevel>& levels) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.is_open()) return false;
+    LodHeader header;
+    in.read((char*)&header, sizeof(header));
+    if (!in.good() || memcmp(header.magic, LOD_MAGIC, 4) || header.version != LOD_VERSION || header.source != source ||
+        header.levels < 0 || header.levels > 32) {
+        return false;
+    }
+    levels.resize(header.levels);
+    for (int i = 0; i < header.levels && in.good(); i++) {
+        int nfaces = 0;
+        in.read((char*)&levels[i].error, sizeof(float));
+        in.read((char*)&nfaces, sizeof(int));
+        if (!in.good() || nfaces < 0 || nfaces > (int)faces_.size()) {
+            in.setstate(std::ios::failbit);
+            break;
+        }
+        levels[i].faces.assign(nfaces, std::vector<Vec3i>(3));
+        for (int f = 0; f < nfaces; f++) {
+            for (int j = 0; j < 3; j++) {
+                Vec3i& c = levels[i].faces[f][j];
+                in.read((char*)c.raw, sizeof(c.raw));
+                if (c.ivert < 0 || c.ivert >= (int)verts_.size() || c.iuv < 0 || c.iuv >= (int)uv_.size()) in.setstate(std::ios::failbit);
+            }
+        }
+    }
+    if (!in.good()) {
+        std::cerr << "bad lod file " << filename << "\n";
+        levels.clear();
+        return false;
+    }
+    return true;
+}
+
+bool Model::write_lod_file(const std::string& filename, unsigned long long source, const std::vector<LodLevel>& levels) {
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    LodHeader header;
+    memcpy(header.magic, LOD_MAGIC, 4);
+    header.version = LOD_VERSION;
+    header.source = source;
+    header.levels = (int)levels.size();
+    out.write((char*)&header, sizeof(header));
+    for (int i = 0; i < (int)levels.size(); i++) {
+        int nfaces = (int)levels[i].faces.size();
+        out.write((char*)&levels[i].error, sizeof(float));
+        out.write((char*)&nfaces, sizeof(int));
+        for (int f = 0; f < nfaces; f++)
+            for (int j = 0; j < 3; j++)
+                out.write((char*)levels[i].faces[f][j].raw, sizeof(levels[i].faces[f][j].raw));
+    }
+    if (!out.good()) {
+        std::cerr << "can't write the lod file " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+// the full mesh and its levels of detail, 0 being the full mesh
+int Model::nlods() {
+    return (int)lods_.size() + 1;
+}
+
+Model* Model::lod(int i) {
+    return i <= 0 ? this : lods_[std::min(i, (int)lods_.size()) - 1].get();
+}
+
+float Model::lod_error() {
+    return lodError_;
 }
 
 Vec3f Model::vert(int i) {
-    return verts_[i];
+    return verts()[i];
+}
+
+void Model::bounds(Vec3f& lo, Vec3f& hi) {
+    const std::vector<Vec3f>& verts = this->verts();
+    lo = hi = verts.empty() ? Vec3f() : verts[0];
+    for (int i = 1; i < (int)verts.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            lo.raw[j] = std::min(lo.raw[j], verts[i].raw[j]);
+            hi.raw[j] = std::max(hi.raw[j], verts[i].raw[j]);
+        }
+    }
+}
+
+std::string Model::texture_path(const std::string& filename, const char* suffix) {
+    size_t dot = filename.find_last_of(".");
+    if (dot == std::string::npos) return std::string();
+    return filename.substr(0, dot) + std::string(suffix);
 }
 
-void Model::load_texture(std::string filename, const char* suffix, TGAImage& img) {
-    std::string texfile(filename);
-    size_t dot = texfile.find_last_of(".");
-    if (dot != std::string::npos) {
-        texfile = texfile.substr(0, dot) + std::string(suffix);
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        img.flip_vertically();
+void Model::load_texture(std::string filename, const char* suffix, std::shared_ptr<TGAImage>& img, AssetCache* assets) {
+    std::string texfile = texture_path(filename, suffix);
+    if (texfile.empty()) {
+        img = std::make_shared<TGAImage>();
+        return;
+    }
+    if (assets && assets->texture_compression()) {
+        blockmap_ = assets->block_texture(texfile, true);
+        img = std::make_shared<TGAImage>();
+        std::cerr << "texture file " << texfile << " loading " << (blockmap_->get_width() ? "ok" : "failed") << " (bc1)" << std::endl;
+        return;
+    }
+    if (assets) {
+        img = assets->texture(texfile, true);
+        std::cerr << "texture file " << texfile << " loading " << (img->buffer() ? "ok" : "failed") << std::endl;
+        return;
     }
+    img = std::make_shared<TGAImage>();
+    std::cerr << "texture file " << texfile << " loading " << (img->read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
+    img->flip_vertically();
 }
 
 TGAColor Model::diffuse(Vec2i uv) {
-    return diffusemap_.get(uv.x, uv.y);
+    if (blockmap_) return blockmap_->get(uv.x, uv.y);
+    return diffusemap_->get(uv.x, uv.y);
+}
+
+int Model::texture_width() {
+    return blockmap_ ? blockmap_->get_width() : diffusemap_->get_width();
+}
+
+int Model::texture_height() {
+    return blockmap_ ? blockmap_->get_height() : diffusemap_->get_height();
+}
+
+std::shared_ptr<const TGAImage> Model::diffusemap() {
+    return diffusemap_;
 }
 
 Vec2i Model::uv(int iface, int nvert) {
     int idx = faces_[iface][nvert][1];
-    return Vec2i(uv_[idx].x * diffusemap_.get_width(), uv_[idx].y * diffusemap_.get_height());
+    const Vec2f& uv = uvs()[idx];
+    return Vec2i(uv.x * texture_width(), uv.y * texture_height());
 }
\ No newline at end of file
@@ -2,25 +2,80 @@
 #define __MODEL_H__
 
 #include <vector>
+#include <memory>
+#include <string>
+#include <mutex>
 #include "geometry.h"
 #include "tgaimage.h"
 
+class AssetCache;
+class BlockTexture;
+struct LodLevel;
+
+#pragma pack(push,1)
+struct LodHeader {
+	char magic[4];
+	int version;
+	unsigned long long source; // hash of the mesh the levels were simplified from
+	int levels;
+};
+#pragma pack(pop)
+
+// cluster of neighbouring faces that can be culled as a whole: a bounding sphere for screen and
+// occlusion tests and a cone bounding the face normals for backface rejection
+struct Meshlet {
+	int first, count;   // range of Model::meshlet_face()
+	Vec3f center;
+	float radius;
+	Vec3f coneAxis;     // every face of the cluster faces away from a view direction d with coneAxis * d < -coneCutoff
+	float coneCutoff;
+};
+
 class Model {
 private:
 	std::vector<Vec3f> verts_;
 	std::vector<std::vector<Vec3i> > faces_;
 	std::vector<Vec2f> uv_;
-	TGAImage diffusemap_;
-	void load_texture(std::string filename, const char* suffix, TGAImage& img);
+	Model* base_; // the full mesh a level of detail uses the vertices and uvs of, NULL for the full mesh itself
+	std::shared_ptr<TGAImage> diffusemap_;
+	std::shared_ptr<BlockTexture> blockmap_; // compressed diffuse map, used instead of diffusemap_ when set
+	std::vector<Vec2i> edges_;
+	std::once_flag edgesOnce_;
+	std::vector<Meshlet> meshlets_;
+	std::vector<int> meshletFaces_;
+	std::vector<std::shared_ptr<Model> > lods_; // coarser and coarser versions of the mesh, without this one
+	float lodError_;                            // how far this mesh may be from the full one, in model units
+	Model(Model& base, const LodLevel& level);
+	const std::vector<Vec3f>& verts() const { return base_ ? base_->verts_ : verts_; }
+	const std::vector<Vec2f>& uvs() const { return base_ ? base_->uv_ : uv_; }
+	void build_meshlets();
+	bool read_lod_file(const std::string& filename, unsigned long long source, std::vector<LodLevel>& levels);
+	bool write_lod_file(const std::string& filename, unsigned long long source, const std::vector<LodLevel>& levels);
+	void load_texture(std::string filename, const char* suffix, std::shared_ptr<TGAImage>& img, AssetCache* assets);
 public:
-	Model(const char *filename);
+	Model(const char *filename, AssetCache* assets = NULL);
+	Model(std::shared_ptr<TGAImage> diffusemap);
+	Model(std::shared_ptr<BlockTexture> blockmap);
 	~Model();
+	static std::string texture_path(const std::string& filename, const char* suffix);
 	int nverts();
 	int nfaces();
+	size_t memory_usage();
 	Vec3f vert(int i);
+	void bounds(Vec3f& lo, Vec3f& hi);
 	Vec2i uv(int iface, int nvert);
 	TGAColor diffuse(Vec2i uv);
-	std::vector<int> face(int idx);
+	int texture_width();
+	int texture_height();
+	std::shared_ptr<const TGAImage> diffusemap();
+	int face_vert(int iface, int nvert);
+	const std::vector<Vec2i>& edges();
+	const std::vector<Meshlet>& meshlets();
+	int meshlet_face(int i);
+	bool build_lods(const std::string& cacheFile, unsigned long long source);
+	int nlods();
+	Model* lod(int i);
+	float lod_error();
 };
 
 #endif //__MODEL_H__
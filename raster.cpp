@@ -0,0 +1,808 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include "raster.h"
+#include "shadow.h"
+#include "tilebuffer.h"
+#include "arena.h"
+
+Vec3f GetBarycentric(Vec3f point, Vec3f* t)
+{
+    Vec2f AB = Vec2f(t[1].x, t[1].y) - Vec2f(t[0].x, t[0].y);
+    Vec2f AC = Vec2f(t[2].x, t[2].y) - Vec2f(t[0].x, t[0].y);
+    Vec2f PA = Vec2f(t[0].x, t[0].y) - Vec2f(point.x, point.y);
+
+    Vec3f v1{ AB.x, AC.x, PA.x };
+    Vec3f v2{ AB.y, AC.y, PA.y };
+
+    int crossZ = (v1.x * v2.y) - (v1.y * v2.x);
+
+    //point and t's has integers as coordinates, so abs(crossZ) < 1 means that crossZ is 0
+    //and thus triangle is degenerate
+    if (std::abs(crossZ) < 1)
+        return Vec3f(-1);
+
+    float crossX = (v1.y * v2.z) - (v2.y * v1.z);
+    float crossY = (v2.x * v1.z) - (v1.x * v2.z);
+
+    return Vec3f{ 1 - (crossX + crossY) / crossZ, crossX / crossZ, crossY / crossZ };
+}
+
+// GetBarycentric split into its per triangle and per sample halves so that the raster loops
+// can reject uncovered samples by the signs of the edge functions alone; for every sample that gets
+// through, the result is bit for bit what GetBarycentric returns
+struct TriangleSetup
+{
+    Vec2f A, AB, AC;
+    int crossZ;
+
+    TriangleSetup(const Vec3f* t) : A(t[0].x, t[0].y)
+    {
+        AB = Vec2f(t[1].x, t[1].y) - A;
+        AC = Vec2f(t[2].x, t[2].y) - A;
+        crossZ = (AB.x * AC.y) - (AC.x * AB.y);
+    }
+
+    bool degenerate() const { return std::abs(crossZ) < 1; }
+
+    bool covers(Vec3f point, Vec3f& barycentric) const
+    {
+        Vec2f PA = A - Vec2f(point.x, point.y);
+        float crossX = (AC.x * PA.y) - (AC.y * PA.x);
+        if ((crossX < 0 && crossZ > 0) || (crossX > 0 && crossZ < 0))
+            return false;
+        float crossY = (AB.y * PA.x) - (AB.x * PA.y);
+        if ((crossY < 0 && crossZ > 0) || (crossY > 0 && crossZ < 0))
+            return false;
+        barycentric = Vec3f{ 1 - (crossX + crossY) / crossZ, crossX / crossZ, crossY / crossZ };
+        return barycentric.x >= 0;
+    }
+
+    // narrows first..last (exclusive) to the columns of the row at y that may hold covered samples, for
+    // samples at x0 + column. Each of the three conditions covers() checks is linear in the column; they are
+    // solved in double with a margin far beyond the rounding of covers(), which still decides every sample.
+    void span(float x0, float y, int& first, int& last) const
+    {
+        double s = crossZ > 0 ? 1 : -1;
+        double dy = A.y - y;
+        double dx = std::max(std::abs(A.x - x0 - first), std::abs(A.x - x0 - last)) + 1;
+        double magnitude = std::abs(A.x) + std::abs(A.y) + std::abs(x0) + std::abs(y) + dx + 1;
+        // crossX, crossY and crossZ - crossX - crossY as a + b * x, with e the slack each is allowed
+        double a[3], b[3], e[3];
+        a[0] = AC.x * dy - AC.y * A.x;
+        b[0] = AC.y;
+        e[0] = (std::abs(AC.x) + std::abs(AC.y)) * magnitude * 1e-5 + 1e-3;
+        a[1] = AB.y * A.x - AB.x * dy;
+        b[1] = -AB.y;
+        e[1] = (std::abs(AB.x) + std::abs(AB.y)) * magnitude * 1e-5 + 1e-3;
+        a[2] = crossZ - a[0] - a[1];
+        b[2] = -b[0] - b[1];
+        e[2] = e[0] + e[1] + std::abs(crossZ) * 1e-5;
+
+        double lo = first, hi = last - 1;
+        for (int k = 0; k < 3; k++)
+        {
+            double start = s * (a[k] + b[k] * x0), slope = s * b[k];
+            if (slope == 0)
+            {
+                if (start < -e[k])
+                    lo = hi + 1;
+                continue;
+            }
+            double bound = (-e[k] - start) / slope;
+            if (slope > 0)
+                lo = std::max(lo, bound);
+            else
+                hi = std::min(hi, bound);
+        }
+        if (lo > hi)
+        {
+            last = first;
+            return;
+        }
+        first = std::max(first, (int)std::floor(lo) - 1);
+        last = std::min(last, (int)std::ceil(hi) + 2);
+    }
+};
+
+// true when a mask is set and the pixel falls outside its dirty tiles
+static bool Masked(const DirtyTiles* mask, int x, int y)
+{
+    return mask && !mask->test(x, y);
+}
+
+static bool Skipped(const DirtyTiles* mask, const BoundingBox& bb)
+{
+    return mask && !mask->any(std::floor(bb.lowerLeft.x), std::floor(bb.lowerLeft.y), bb.upperRight.x, bb.upperRight.y);
+}
+
+static BoundingBox GetBoundingBox(Vec3f* t)
+{
+    BoundingBox bb{ Vec2f(std::numeric_limits<float>::max()), Vec2f(-std::numeric_limits<float>::max()) };
+    for (int i = 0; i < 3; i++)
+    {
+        Vec3f vert = t[i];
+        if (bb.lowerLeft.x > vert.x)
+            bb.lowerLeft.x = vert.x;
+        if (bb.lowerLeft.y > vert.y)
+            bb.lowerLeft.y = vert.y;
+        if (bb.upperRight.x < vert.x)
+            bb.upperRight.x = vert.x;
+        if (bb.upperRight.y < vert.y)
+            bb.upperRight.y = vert.y;
+    }
+    return bb;
+}
+
+static TGAColor SampleTexture(const Vec3f& barycentric, Vec2i* uvs, Model* model)
+{
+    Vec2i uv;
+    uv += uvs[0] * barycentric.raw[0];
+    uv += uvs[1] * barycentric.raw[1];
+    uv += uvs[2] * barycentric.raw[2];
+    return model->diffuse(uv);
+}
+
+static void ApplyShadow(TGAColor& color, const Vec3f& barycentric, ShadowMap* shadow, Vec3f* lightCoords)
+{
+    Vec3f p = lightCoords[0] * barycentric.raw[0] + lightCoords[1] * barycentric.raw[1] + lightCoords[2] * barycentric.raw[2];
+    float shade = shadow->shade(p);
+    for (int j = 0; j < 3; j++)
+        color.raw[j] = (unsigned char)(color.raw[j] * shade);
+}
+
+static TGAColor ShadeSample(Vec3f barycentric, Vec2i* uvs, Model* model, ShadowMap* shadow, Vec3f* lightCoords)
+{
+    TGAColor color = SampleTexture(barycentric, uvs, model);
+    if (shadow)
+        ApplyShadow(color, barycentric, shadow, lightCoords);
+    return color;
+}
+
+// index of the bounding box column (or row) whose sample lands on pixel x: samples sit at whole steps from
+// the box corner and are truncated to a pixel, which is not always x - floor(origin) once rounding kicks in
+static int SampleIndex(int x, float origin)
+{
+    int i = x - (int)std::floor(origin);
+    if ((int)(i + origin) > x)
+        i--;
+    else if ((int)(i + origin) < x)
+        i++;
+    return i;
+}
+
+// columns (or rows) first..last (exclusive) of a bounding box count long whose samples can land on a screen
+// size pixels across, give or take one for the rounding
+static void ScreenRange(float origin, int count, int size, int& first, int& last)
+{
+    first = std::max(0, SampleIndex(0, origin) - 1);
+    last = std::min(count, SampleIndex(size - 1, origin) + 2);
+}
+
+// pipeline state given by template arguments: every check on it is a constant, so each instantiation of
+// RasterTriangle keeps only the work its state needs
+template <DepthFunc Depth, bool DepthWrite, bool Texture, BlendMode Blend, int Bytespp, bool Shadow>
+struct StaticState
+{
+    StaticState(const DrawCall&) {}
+    DepthFunc depth_func() const { return Depth; }
+    bool depth_write() const { return DepthWrite; }
+    bool texture() const { return Texture; }
+    BlendMode blend() const { return Blend; }
+    int bytespp() const { return Bytespp; }
+    bool shadow() const { return Shadow; }
+};
+
+// the same checks against the draw at run time
+struct DynamicState
+{
+    const PipelineState& state;
+    bool hasShadow;
+
+    DynamicState(const DrawCall& draw) : state(draw.state), hasShadow(draw.shadow != NULL) {}
+    DepthFunc depth_func() const { return state.depthFunc; }
+    bool depth_write() const { return state.depthWrite; }
+    bool texture() const { return state.texture; }
+    BlendMode blend() const { return state.blend; }
+    int bytespp() const { return state.bytespp; }
+    bool shadow() const { return hasShadow; }
+};
+
+template <class State>
+static void WritePixel(const State& state, const TGAColor& color, int opacity, unsigned char* pixel)
+{
+    for (int j = 0; j < state.bytespp(); j++)
+    {
+        if (state.blend() == BLEND_ADD)
+            pixel[j] = (unsigned char)std::min(pixel[j] + color.raw[j], 255);
+        else if (state.blend() == BLEND_ALPHA)
+            pixel[j] = (unsigned char)((color.raw[j] * opacity + pixel[j] * (255 - opacity) + 127) / 255);
+        else
+            pixel[j] = color.raw[j];
+    }
+}
+
+// filled_triangle's loop with its state spelled out: the same samples in the same order, row by row
+template <class State>
+static void RasterTriangle(const DrawCall& draw, Vec3f* t, Vec2i* uvs, Vec3f* lightCoords)
+{
+    const State state(draw);
+    BoundingBox bb = GetBoundingBox(t);
+    if (Skipped(draw.mask, bb))
+        return;
+    int width = draw.image->get_width();
+    int height = draw.image->get_height();
+    unsigned char* pixels = draw.image->buffer();
+    float* zBuffer = draw.zBuffer;
+
+    TriangleSetup setup(t);
+    if (setup.degenerate())
+        return;
+    DepthPlane plane(t, bb.lowerLeft);
+
+    int colNum = bb.upperRight.x - bb.lowerLeft.x;
+    int rowNum = bb.upperRight.y - bb.lowerLeft.y;
+    int col0, col1, row0, row1;
+    ScreenRange(bb.lowerLeft.x, colNum, width, col0, col1);
+    ScreenRange(bb.lowerLeft.y, rowNum, height, row0, row1);
+
+    for (int row = row0; row < row1; row++)
+    {
+        int first = col0, last = col1;
+        setup.span(bb.lowerLeft.x, row + bb.lowerLeft.y, first, last);
+        for (int col = first; col < last; col++)
+        {
+            Vec3f pix{ col + bb.lowerLeft.x, row + bb.lowerLeft.y, 0 };
+            Vec3f barycentric;
+            if (!setup.covers(pix, barycentric))
+                continue;
+
+            pix.z = plane.at(col, row);
+
+            int x = pix.x, y = pix.y;
+            if (x < 0 || y < 0 || x >= width || y >= height)
+                continue;
+            int index = x + width * y;
+
+            if (Masked(draw.mask, x, y))
+                continue;
+
+            if (state.depth_func() == DEPTH_GREATER && zBuffer[index] >= pix.z)
+                continue;
+            if (state.depth_func() == DEPTH_EQUAL && zBuffer[index] != pix.z)
+                continue;
+            if (state.depth_write())
+                zBuffer[index] = state.depth_func() == DEPTH_EQUAL ? std::nextafter(pix.z, std::numeric_limits<float>::max()) : pix.z;
+            if (state.blend() == BLEND_DISCARD)
+                continue;
+
+            TGAColor color = state.texture() ? SampleTexture(barycentric, uvs, draw.model) : draw.color;
+            if (state.shadow())
+                ApplyShadow(color, barycentric, draw.shadow, lightCoords);
+            WritePixel(state, color, draw.opacity, pixels + (size_t)index * state.bytespp());
+        }
+    }
+}
+
+void filled_triangle_general(const DrawCall& draw, Vec3f* t, Vec2i* uvs, Vec3f* lightCoords)
+{
+    RasterTriangle<DynamicState>(draw, t, uvs, lightCoords);
+}
+
+// the dispatcher fixes one field of the state per level, down to the instantiation for all of them
+template <DepthFunc Depth, bool DepthWrite, bool Texture, BlendMode Blend, int Bytespp>
+static TriangleFn SelectShadow(const DrawCall& draw)
+{
+    if (draw.shadow)
+        return &RasterTriangle<StaticState<Depth, DepthWrite, Texture, Blend, Bytespp, true> >;
+    return &RasterTriangle<StaticState<Depth, DepthWrite, Texture, Blend, Bytespp, false> >;
+}
+
+template <DepthFunc Depth, bool DepthWrite, bool Texture, BlendMode Blend>
+static TriangleFn SelectFormat(const DrawCall& draw)
+{
+    switch (draw.state.bytespp)
+    {
+    case TGAImage::GRAYSCALE: return SelectShadow<Depth, DepthWrite, Texture, Blend, TGAImage::GRAYSCALE>(draw);
+    case TGAImage::RGBA: return SelectShadow<Depth, DepthWrite, Texture, Blend, TGAImage::RGBA>(draw);
+    default: return SelectShadow<Depth, DepthWrite, Texture, Blend, TGAImage::RGB>(draw);
+    }
+}
+
+template <DepthFunc Depth, bool DepthWrite, bool Texture>
+static TriangleFn SelectBlend(const DrawCall& draw)
+{
+    switch (draw.state.blend)
+    {
+    case BLEND_ADD: return SelectFormat<Depth, DepthWrite, Texture, BLEND_ADD>(draw);
+    case BLEND_ALPHA: return SelectFormat<Depth, DepthWrite, Texture, BLEND_ALPHA>(draw);
+    case BLEND_DISCARD: return SelectFormat<Depth, DepthWrite, Texture, BLEND_DISCARD>(draw);
+    default: return SelectFormat<Depth, DepthWrite, Texture, BLEND_REPLACE>(draw);
+    }
+}
+
+template <DepthFunc Depth, bool DepthWrite>
+static TriangleFn SelectTexture(const DrawCall& draw)
+{
+    return draw.state.texture ? SelectBlend<Depth, DepthWrite, true>(draw) : SelectBlend<Depth, DepthWrite, false>(draw);
+}
+
+template <DepthFunc Depth>
+static TriangleFn SelectDepthWrite(const DrawCall& draw)
+{
+    return draw.state.depthWrite ? SelectTexture<Depth, true>(draw) : SelectTexture<Depth, false>(draw);
+}
+
+TriangleFn select_pipeline(const DrawCall& draw)
+{
+    switch (draw.state.depthFunc)
+    {
+    case DEPTH_EQUAL: return SelectDepthWrite<DEPTH_EQUAL>(draw);
+    case DEPTH_ALWAYS: return SelectDepthWrite<DEPTH_ALWAYS>(draw);
+    default: return SelectDepthWrite<DEPTH_GREATER>(draw);
+    }
+}
+
+void filled_triangle(Vec3f* t, TGAImage& image, Vec2i* uvs, Model* model, float zBuffer[],
+                     ShadowMap* shadow, Vec3f* lightCoords, DepthFunc depthFunc, const DirtyTiles* mask)
+{
+    DrawCall draw(image, zBuffer, model, shadow, mask);
+    draw.state.depthFunc = depthFunc;
+    select_pipeline(draw)(draw, t, uvs, lightCoords);
+}
+
+DepthPlane::DepthPlane(const Vec3f* t, Vec2f corner) : origin(corner)
+{
+    // solved in double from the vertices and rounded once, c is the depth at the corner itself
+    double abx = t[1].x - t[0].x, aby = t[1].y - t[0].y, abz = t[1].z - t[0].z;
+    double acx = t[2].x - t[0].x, acy = t[2].y - t[0].y, acz = t[2].z - t[0].z;
+    double det = abx * acy - acx * aby;
+    double da = det != 0 ? (abz * acy - acz * aby) / det : 0;
+    double db = det != 0 ? (abx * acz - acx * abz) / det : 0;
+    a = (float)da;
+    b = (float)db;
+    c = (float)(t[0].z + da * (corner.x - t[0].x) + db * (corner.y - t[0].y));
+}
+
+float DepthPlane::depth(int x, int y) const
+{
+    return at(SampleIndex(x, origin.x), SampleIndex(y, origin.y));
+}
+
+// filled_triangle into a tile buffer, one tile at a time. A tile the triangle covers entirely, with every
+// sample passing the depth test, keeps just the triangle's depth plane and one color if that is all it got;
+// only partially covered tiles have their raw depth and color expanded. The samples and the order they are
+// written in are the same as filled_triangle's, so the resolved frame is too. Mask tiles have to line up
+// with the buffer's.
+void filled_triangle(Vec3f* t, TileBuffer& buffer, Vec2i* uvs, Model* model,
+                     ShadowMap* shadow, Vec3f* lightCoords, const DirtyTiles* mask)
+{
+    BoundingBox bb = GetBoundingBox(t);
+    if (Skipped(mask, bb))
+        return;
+    TriangleSetup setup(t);
+    if (setup.degenerate())
+        return;
+    DepthPlane plane(t, bb.lowerLeft);
+
+    int colNum = bb.upperRight.x - bb.lowerLeft.x;
+    int rowNum = bb.upperRight.y - bb.lowerLeft.y;
+    if (colNum <= 0 || rowNum <= 0)
+        return;
+    int x0 = std::max(0, (int)bb.lowerLeft.x), x1 = std::min(buffer.width() - 1, (int)((colNum - 1) + bb.lowerLeft.x));
+    int y0 = std::max(0, (int)bb.lowerLeft.y), y1 = std::min(buffer.height() - 1, (int)((rowNum - 1) + bb.lowerLeft.y));
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    int size = buffer.tile_size();
+    int bytespp = buffer.bytespp();
+    int screenCol0, screenCol1;
+    ScreenRange(bb.lowerLeft.x, colNum, buffer.width(), screenCol0, screenCol1);
+
+    // columns that may be covered on every row of samples landing on the screen, worked out once for all
+    // the tiles the row crosses; scratch from the frame arena, handed back on the way out
+    int rows0 = std::max(0, SampleIndex(y0, bb.lowerLeft.y) - 1), rows1 = std::min(rowNum - 1, SampleIndex(y1, bb.lowerLeft.y) + 1);
+    FrameArena& arena = FrameArena::local();
+    size_t mark = arena.mark();
+    int* spans = arena.allocate<int>(2 * (rows1 - rows0 + 1));
+    for (int row = rows0; row <= rows1; row++)
+    {
+        int first = screenCol0, last = screenCol1;
+        setup.span(bb.lowerLeft.x, row + bb.lowerLeft.y, first, last);
+        spans[2 * (row - rows0)] = first;
+        spans[2 * (row - rows0) + 1] = last;
+    }
+
+    for (int ty = y0 / size; ty <= y1 / size; ty++)
+    {
+        // columns the triangle may cover on any row landing in this row of tiles, only their tiles are visited;
+        // rows outside rows0..rows1 land off the screen
+        int tileX0, tileY0, tileX1, tileY1;
+        buffer.rect(0, ty, tileX0, tileY0, tileX1, tileY1);
+        int spanFirst = screenCol1, spanLast = screenCol0;
+        int rowFirst = std::max(rows0, SampleIndex(tileY0, bb.lowerLeft.y) - 1), rowLast = std::min(rows1, SampleIndex(tileY1 - 1, bb.lowerLeft.y) + 1);
+        for (int row = rowFirst; row <= rowLast; row++)
+        {
+            int first = spans[2 * (row - rows0)], last = spans[2 * (row - rows0) + 1];
+            if (first < last)
+            {
+                spanFirst = std::min(spanFirst, first);
+                spanLast = std::max(spanLast, last);
+            }
+        }
+        if (spanFirst >= spanLast)
+            continue;
+        int txFirst = std::max(x0, (int)(spanFirst + bb.lowerLeft.x)) / size;
+        int txLast = std::min(x1, (int)((spanLast - 1) + bb.lowerLeft.x)) / size;
+
+        for (int tx = txFirst; tx <= txLast; tx++)
+        {
+            buffer.rect(tx, ty, tileX0, tileY0, tileX1, tileY1);
+            if (Masked(mask, tileX0, tileY0))
+                continue;
+            TileBuffer::Tile& tile = buffer.tile(tx, ty);
+
+            // columns and rows whose samples land in the tile, in the order filled_triangle visits them
+            int col0 = std::max(0, SampleIndex(tileX0, bb.lowerLeft.x) - 1), col1 = std::min(colNum - 1, SampleIndex(tileX1 - 1, bb.lowerLeft.x) + 1);
+            int row0 = rowFirst, row1 = rowLast;
+
+            // whole tile: exactly one sample per pixel, all covered, all passing; a triangle with fewer
+            // columns or rows of samples over the tile than it has pixels across never is
+            bool whole = col1 - col0 + 1 >= tileX1 - tileX0 && row1 - row0 + 1 >= tileY1 - tileY0;
+            for (int col = col0, x = tileX0; whole && col <= col1; col++)
+            {
+                int px = (int)(col + bb.lowerLeft.x);
+                if (px >= tileX0 && px < tileX1)
+                    whole = px == x++;
+                if (col == col1)
+                    whole = whole && x == tileX1;
+            }
+            for (int row = row0, y = tileY0; whole && row <= row1; row++)
+            {
+                int py = (int)(row + bb.lowerLeft.y);
+                if (py >= tileY0 && py < tileY1)
+                    whole = py == y++;
+                if (row == row1)
+                    whole = whole && y == tileY1;
+            }
+            for (int row = row0; whole && row <= row1; row++)
+            {
+                for (int col = col0; whole && col <= col1; col++)
+                {
+                    Vec3f pix{ col + bb.lowerLeft.x, row + bb.lowerLeft.y, 0 };
+                    int x = pix.x, y = pix.y;
+                    if (x < tileX0 || y < tileY0 || x >= tileX1 || y >= tileY1)
+                        continue;
+                    Vec3f barycentric;
+                    whole = setup.covers(pix, barycentric);
+                    if (!whole)
+                        continue;
+                    float z = tile.depthMode == TileBuffer::TILE_CLEAR ? buffer.clear_depth() :
+                              tile.depthMode == TileBuffer::TILE_PLANE ? tile.plane.depth(x, y) : tile.depth[(x - tileX0) + (y - tileY0) * size];
+                    whole = z < plane.at(col, row);
+                }
+            }
+
+            if (whole)
+            {
+                buffer.set_plane(tx, ty, plane);
+                unsigned char* pixels = buffer.pixels(tx, ty, false);
+                TGAColor first;
+                bool constant = true;
+                for (int row = row0; row <= row1; row++)
+                {
+                    for (int col = col0; col <= col1; col++)
+                    {
+                        Vec3f pix{ col + bb.lowerLeft.x, row + bb.lowerLeft.y, 0 };
+                        int x = pix.x, y = pix.y;
+                        if (x < tileX0 || y < tileY0 || x >= tileX1 || y >= tileY1)
+                            continue;
+                        Vec3f barycentric;
+                        setup.covers(pix, barycentric);
+                        TGAColor color = ShadeSample(barycentric, uvs, model, shadow, lightCoords);
+                        if (x == tileX0 && y == tileY0)
+                            first = color;
+                        constant = constant && color.val == first.val;
+                        memcpy(pixels + ((x - tileX0) + (y - tileY0) * size) * bytespp, color.raw, bytespp);
+                    }
+                }
+                if (constant)
+                    buffer.set_color(tx, ty, first);
+                continue;
+            }
+
+            float* depth = NULL;
+            unsigned char* pixels = NULL;
+            for (int row = row0; row <= row1; row++)
+            {
+                int first = std::max(col0, spans[2 * (row - rows0)]), last = std::min(col1 + 1, spans[2 * (row - rows0) + 1]);
+                for (int col = first; col < last; col++)
+                {
+                    Vec3f pix{ col + bb.lowerLeft.x, row + bb.lowerLeft.y, 0 };
+                    int x = pix.x, y = pix.y;
+                    if (x < tileX0 || y < tileY0 || x >= tileX1 || y >= tileY1)
+                        continue;
+                    Vec3f barycentric;
+                    if (!setup.covers(pix, barycentric))
+                        continue;
+                    pix.z = plane.at(col, row);
+
+                    if (!depth)
+                        depth = buffer.depth(tx, ty);
+                    float& z = depth[(x - tileX0) + (y - tileY0) * size];
+                    if (z >= pix.z)
+                        continue;
+                    z = pix.z;
+                    if (!pixels)
+                        pixels = buffer.pixels(tx, ty);
+                    TGAColor color = ShadeSample(barycentric, uvs, model, shadow, lightCoords);
+                    memcpy(pixels + ((x - tileX0) + (y - tileY0) * size) * bytespp, color.raw, bytespp);
+                }
+            }
+        }
+    }
+    arena.rewind(mark);
+}
+
+void depth_triangle(Vec3f* t, float zBuffer[], int width, int height, const DirtyTiles* mask)
+{
+    BoundingBox bb = GetBoundingBox(t);
+    if (Skipped(mask, bb))
+        return;
+
+    TriangleSetup setup(t);
+    if (setup.degenerate())
+        return;
+    DepthPlane plane(t, bb.lowerLeft);
+
+    int colNum = bb.upperRight.x - bb.lowerLeft.x;
+    int rowNum = bb.upperRight.y - bb.lowerLeft.y;
+    int col0, col1, row0, row1;
+    ScreenRange(bb.lowerLeft.x, colNum, width, col0, col1);
+    ScreenRange(bb.lowerLeft.y, rowNum, height, row0, row1);
+
+    for (int row = row0; row < row1; row++)
+    {
+        int first = col0, last = col1;
+        setup.span(bb.lowerLeft.x, row + bb.lowerLeft.y, first, last);
+        for (int col = first; col < last; col++)
+        {
+            Vec3f pix{ col + bb.lowerLeft.x, row + bb.lowerLeft.y, 0 };
+            Vec3f barycentric;
+            if (!setup.covers(pix, barycentric))
+                continue;
+
+            pix.z = plane.at(col, row);
+
+            int x = pix.x, y = pix.y;
+            if (x < 0 || y < 0 || x >= width || y >= height)
+                continue;
+            int zBufferIndex = x + width * y;
+
+            if (Masked(mask, x, y))
+                continue;
+
+            if (zBuffer[zBufferIndex] < pix.z)
+                zBuffer[zBufferIndex] = pix.z;
+        }
+    }
+}
+
+static const int SUBPIXEL_BITS = 4;
+static const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+static const int SUBPIXEL_LIMIT = 1 << 14; // pixels, keeps the edge function products within 64 bits
+static const int DEPTH_FRACTION_BITS = 16;
+static const int BARYCENTRIC_BITS = 16;
+static const int RECIPROCAL_BITS = 40; // edge functions stay below 2^40, so a reciprocal quotient is at most one short
+
+static long long ToSubpixel(float v)
+{
+    v = std::min(std::max(v, (float)-SUBPIXEL_LIMIT), (float)SUBPIXEL_LIMIT);
+    return (long long)std::floor(v * SUBPIXEL_ONE + .5f);
+}
+
+static int ToFixedDepth(float z)
+{
+    z = std::min(std::max(z, -32767.f), 32767.f);
+    return (int)std::floor(z * (1 << DEPTH_FRACTION_BITS) + .5f);
+}
+
+// edge a->b evaluated at p, positive on the left of the edge
+static long long Edge(long long ax, long long ay, long long bx, long long by, long long px, long long py)
+{
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+// w * 2^BARYCENTRIC_BITS / area for 0 <= w <= area, from the triangle's reciprocal instead of a division;
+// the quotient the reciprocal gives is at most one short, the remainder check makes it exact
+static long long Barycentric(long long w, long long area, long long reciprocal)
+{
+    long long q = (w * reciprocal) >> RECIPROCAL_BITS;
+    if ((q + 1) * area <= w << BARYCENTRIC_BITS)
+        q++;
+    return q;
+}
+
+// with counter clockwise winding (y up) the left edges go down and the top edges go left
+static bool TopLeft(long long ax, long long ay, long long bx, long long by)
+{
+    return (ay == by && bx < ax) || by < ay;
+}
+
+void filled_triangle_fixed(Vec3f* t, TGAImage& image, Vec2i* uvs, Model* model, int zBuffer[],
+                           const DirtyTiles* mask)
+{
+    int width = image.get_width();
+    int height = image.get_height();
+
+    // setup: the last floating point operations, everything below is integer
+    long long X[3], Y[3];
+    int Z[3];
+    int U[3], V[3];
+    for (int i = 0; i < 3; i++)
+    {
+        X[i] = ToSubpixel(t[i].x);
+        Y[i] = ToSubpixel(t[i].y);
+        Z[i] = ToFixedDepth(t[i].z);
+        U[i] = uvs[i].x;
+        V[i] = uvs[i].y;
+    }
+
+    long long area = Edge(X[0], Y[0], X[1], Y[1], X[2], Y[2]);
+    if (area == 0)
+        return;
+    if (area < 0)
+    {
+        std::swap(X[1], X[2]); std::swap(Y[1], Y[2]); std::swap(Z[1], Z[2]);
+        std::swap(U[1], U[2]); std::swap(V[1], V[2]);
+        area = -area;
+    }
+    long long reciprocal = (1LL << (BARYCENTRIC_BITS + RECIPROCAL_BITS)) / area;
+
+    // pixel centers sit at +1/2, visit the ones inside the snapped bounding box
+    long long minX = std::min(X[0], std::min(X[1], X[2])), maxX = std::max(X[0], std::max(X[1], X[2]));
+    long long minY = std::min(Y[0], std::min(Y[1], Y[2])), maxY = std::max(Y[0], std::max(Y[1], Y[2]));
+    int x0 = (int)std::max((minX - SUBPIXEL_ONE / 2 + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, 0LL);
+    int y0 = (int)std::max((minY - SUBPIXEL_ONE / 2 + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, 0LL);
+    int x1 = (int)std::min((maxX - SUBPIXEL_ONE / 2) >> SUBPIXEL_BITS, (long long)width - 1);
+    int y1 = (int)std::min((maxY - SUBPIXEL_ONE / 2) >> SUBPIXEL_BITS, (long long)height - 1);
+    if (x0 > x1 || y0 > y1)
+        return;
+    if (mask && !mask->any(x0, y0, x1, y1))
+        return;
+
+    // w[i] is the edge opposite to vertex i, so that w / area are the barycentric coordinates;
+    // edges that are not top-left lose the samples lying exactly on them
+    const int e[3][2] = { { 1, 2 }, { 2, 0 }, { 0, 1 } };
+    long long rowW[3], stepX[3], stepY[3], bias[3];
+    long long px = ((long long)x0 << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2;
+    long long py = ((long long)y0 << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2;
+    for (int i = 0; i < 3; i++)
+    {
+        int a = e[i][0], b = e[i][1];
+        bias[i] = TopLeft(X[a], Y[a], X[b], Y[b]) ? 0 : -1;
+        rowW[i] = Edge(X[a], Y[a], X[b], Y[b], px, py) + bias[i];
+        stepX[i] = -(Y[b] - Y[a]) * SUBPIXEL_ONE;
+        stepY[i] = (X[b] - X[a]) * SUBPIXEL_ONE;
+    }
+
+    for (int y = y0; y <= y1; y++)
+    {
+        // columns of the row where no edge function is negative, exact since they step by whole numbers
+        long long first = x0, last = x1;
+        for (int i = 0; i < 3; i++)
+        {
+            if (stepX[i] > 0 && rowW[i] < 0)
+                first = std::max(first, x0 + (-rowW[i] + stepX[i] - 1) / stepX[i]);
+            else if (stepX[i] < 0)
+                last = rowW[i] < 0 ? first - 1 : std::min(last, x0 + rowW[i] / -stepX[i]);
+            else if (stepX[i] == 0 && rowW[i] < 0)
+                last = first - 1;
+        }
+        long long w[3];
+        for (int i = 0; i < 3; i++)
+            w[i] = rowW[i] + (first - x0) * stepX[i];
+        for (int x = (int)first; x <= last; x++)
+        {
+            if ((w[0] | w[1] | w[2]) >= 0 && !Masked(mask, x, y))
+            {
+                // normalize to BARYCENTRIC_BITS so that the interpolation products stay small
+                long long b1 = Barycentric(w[1] - bias[1], area, reciprocal);
+                long long b2 = Barycentric(w[2] - bias[2], area, reciprocal);
+                int z = Z[0] + (int)((b1 * ((long long)Z[1] - Z[0]) + b2 * ((long long)Z[2] - Z[0])) >> BARYCENTRIC_BITS);
+                int zBufferIndex = x + width * y;
+                if (zBuffer[zBufferIndex] < z)
+                {
+                    zBuffer[zBufferIndex] = z;
+                    Vec2i uv(U[0] + (int)((b1 * (U[1] - U[0]) + b2 * (U[2] - U[0])) >> BARYCENTRIC_BITS),
+                             V[0] + (int)((b1 * (V[1] - V[0]) + b2 * (V[2] - V[0])) >> BARYCENTRIC_BITS));
+                    image.set(x, y, model->diffuse(uv));
+                }
+            }
+            for (int i = 0; i < 3; i++)
+                w[i] += stepX[i];
+        }
+        for (int i = 0; i < 3; i++)
+            rowW[i] += stepY[i];
+    }
+}
+
+int visible_samples(Vec3f* t, const float zBuffer[], int width, int height)
+{
+    BoundingBox bb = GetBoundingBox(t);
+
+    TriangleSetup setup(t);
+    if (setup.degenerate())
+        return 0;
+    DepthPlane plane(t, bb.lowerLeft);
+
+    int colNum = bb.upperRight.x - bb.lowerLeft.x;
+    int rowNum = bb.upperRight.y - bb.lowerLeft.y;
+    int col0, col1, row0, row1;
+    ScreenRange(bb.lowerLeft.x, colNum, width, col0, col1);
+    ScreenRange(bb.lowerLeft.y, rowNum, height, row0, row1);
+
+    int visible = 0;
+    for (int row = row0; row < row1; row++)
+    {
+        int first = col0, last = col1;
+        setup.span(bb.lowerLeft.x, row + bb.lowerLeft.y, first, last);
+        for (int col = first; col < last; col++)
+        {
+            Vec3f pix{ col + bb.lowerLeft.x, row + bb.lowerLeft.y, 0 };
+            Vec3f barycentric;
+            if (!setup.covers(pix, barycentric))
+                continue;
+
+            pix.z = plane.at(col, row);
+
+            int x = pix.x, y = pix.y;
+            if (x < 0 || y < 0 || x >= width || y >= height)
+                continue;
+            int zBufferIndex = x + width * y;
+
+            if (zBuffer[zBufferIndex] < pix.z)
+                visible++;
+        }
+    }
+    return visible;
+}
+
+int occlusion_query(Vec3f* corners, const float zBuffer[], int width, int height)
+{
+    // faces wound counter clockwise when seen from outside the box
+    static const int quads[6][4] = {
+        { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+        { 0, 1, 5, 4 }, { 2, 6, 7, 3 },
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 }
+    };
+    int visible = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        Vec3f a = corners[quads[i][0]], b = corners[quads[i][1]], c = corners[quads[i][2]], d = corners[quads[i][3]];
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if (area <= 0)
+            continue;
+        Vec3f t0[3] = { a, b, c };
+        Vec3f t1[3] = { a, c, d };
+        visible += visible_samples(t0, zBuffer, width, height);
+        visible += visible_samples(t1, zBuffer, width, height);
+    }
+    return visible;
+}
+
+bool box_occluded(Vec3f lo, Vec3f hi, const float zBuffer[], int width, int height)
+{
+    // samples sit at whole pixel steps from the bounding box corner and are truncated to a pixel index,
+    // so anything above -1 still reaches column or row 0
+    int x0 = std::max(0, (int)std::floor(lo.x)), y0 = std::max(0, (int)std::floor(lo.y));
+    int x1 = std::min(width - 1, (int)std::floor(hi.x)), y1 = std::min(height - 1, (int)std::floor(hi.y));
+    // interpolated depth may overshoot the vertices' by a few ulps
+    float z = hi.z + 1e-4f * std::max(1.f, std::abs(hi.z));
+    for (int y = y0; y <= y1; y++)
+        for (int x = x0; x <= x1; x++)
+            if (zBuffer[x + width * y] < z)
+                return false;
+    return true;
+}
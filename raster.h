@@ -0,0 +1,114 @@
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "tiles.h"
+
+class ShadowMap;
+class TileBuffer;
+
+struct BoundingBox
+{
+    Vec2f lowerLeft;
+    Vec2f upperRight;
+};
+
+enum DepthFunc
+{
+    DEPTH_GREATER, // regular test, closer samples win and update the z buffer
+    DEPTH_EQUAL,   // shading after a depth pre-pass, only the sample that set the z buffer passes; with depth
+                   // write the first one to pass moves the z buffer up an ulp, so ties go to the first as
+                   // with DEPTH_GREATER
+    DEPTH_ALWAYS   // no test, every covered sample passes
+};
+
+enum BlendMode
+{
+    BLEND_REPLACE, // the shaded color replaces the pixel
+    BLEND_ADD,     // the shaded color is added to the pixel, saturating
+    BLEND_ALPHA,   // the shaded color is mixed into the pixel by the draw's opacity
+    BLEND_DISCARD  // no color at all, only depth
+};
+
+// everything about a draw that the raster loop would otherwise have to check at every sample; each
+// combination (and whether there is a shadow map) gets a loop compiled for it alone
+struct PipelineState
+{
+    DepthFunc depthFunc;
+    bool depthWrite;
+    bool texture;    // diffuse map of the model, or the draw's flat color
+    BlendMode blend;
+    int bytespp;     // output format, see TGAImage::Format
+
+    PipelineState(DepthFunc func = DEPTH_GREATER, bool write = true, bool tex = true, BlendMode mode = BLEND_REPLACE,
+                  int format = TGAImage::RGB) : depthFunc(func), depthWrite(write), texture(tex), blend(mode), bytespp(format) {}
+};
+
+// one draw: its pipeline state and everything its triangles are shaded with and written to
+struct DrawCall
+{
+    PipelineState state;
+    TGAImage* image;
+    float* zBuffer;          // same size as image, may be NULL when the state neither tests nor writes depth
+    Model* model;
+    ShadowMap* shadow;       // with a shadow map, triangles come with the light space position of their vertices
+    const DirtyTiles* mask;  // only samples inside its dirty tiles are touched
+    TGAColor color;          // in place of the texture
+    unsigned char opacity;   // BLEND_ALPHA, 255 is opaque
+
+    DrawCall(TGAImage& img, float* z, Model* m, ShadowMap* s = NULL, const DirtyTiles* dirty = NULL) : state(), image(&img),
+        zBuffer(z), model(m), shadow(s), mask(dirty), color(255, 255, 255, 255), opacity(255) {
+        state.bytespp = img.get_bytespp();
+    }
+};
+
+typedef void (*TriangleFn)(const DrawCall& draw, Vec3f* t, Vec2i* uvs, Vec3f* lightCoords);
+
+// raster loop compiled for the pipeline state of the draw; looked up once per draw, then called for every
+// triangle of it. The samples and the order they are written in are those of filled_triangle.
+TriangleFn select_pipeline(const DrawCall& draw);
+
+// the same raster loop, checking the pipeline state at every sample instead; the baseline the loops
+// select_pipeline hands out are measured against
+void filled_triangle_general(const DrawCall& draw, Vec3f* t, Vec2i* uvs, Vec3f* lightCoords);
+
+Vec3f GetBarycentric(Vec3f point, Vec3f* t);
+
+// textured triangle, depth tested against and written to zBuffer (same size as image, bigger z is closer);
+// when a shadow map is given, lightCoords holds the light space position of each vertex;
+// with a mask, only samples inside its dirty tiles are touched. Looks up its raster loop on every call,
+// draws of many triangles should go through select_pipeline.
+void filled_triangle(Vec3f* t, TGAImage& image, Vec2i* uvs, Model* model, float zBuffer[],
+                     ShadowMap* shadow = NULL, Vec3f* lightCoords = NULL, DepthFunc depthFunc = DEPTH_GREATER,
+                     const DirtyTiles* mask = NULL);
+
+// filled_triangle into a tile buffer instead of an image and a z buffer, same samples and same result
+void filled_triangle(Vec3f* t, TileBuffer& buffer, Vec2i* uvs, Model* model,
+                     ShadowMap* shadow = NULL, Vec3f* lightCoords = NULL, const DirtyTiles* mask = NULL);
+
+// depth only fast path: same coverage and depth values as filled_triangle, but no texture fetch
+// and no color write; for z buffers without an image, such as shadow maps (passes into a frame use
+// select_pipeline with BLEND_DISCARD)
+void depth_triangle(Vec3f* t, float zBuffer[], int width, int height, const DirtyTiles* mask = NULL);
+
+// integer only rasterization: vertices snapped to a 1/16 pixel grid, then edge functions, depth (16.16)
+// and uv interpolation in fixed point with a top-left fill rule, sampling at pixel centers; zBuffer holds
+// fixed point depth. The output does not depend on compiler, optimization level or FPU settings.
+void filled_triangle_fixed(Vec3f* t, TGAImage& image, Vec2i* uvs, Model* model, int zBuffer[],
+                           const DirtyTiles* mask = NULL);
+
+// number of samples of the triangle that would pass the depth test, zBuffer is left untouched
+int visible_samples(Vec3f* t, const float zBuffer[], int width, int height);
+
+// occlusion query for a proxy box given by its 8 screen space corners (bit 0 of the index selects max x,
+// bit 1 max y, bit 2 max z): counts the visible samples of its front faces against the current z buffer
+int occlusion_query(Vec3f* corners, const float zBuffer[], int width, int height);
+
+// conservative occlusion test for geometry known to project inside the screen box lo..hi (hi.z its closest
+// depth): true when every pixel it could sample already holds a sample at least as close
+bool box_occluded(Vec3f lo, Vec3f hi, const float zBuffer[], int width, int height);
+
+#endif //__RASTER_H__
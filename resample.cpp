@@ -0,0 +1,253 @@
+#include <cmath>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include "resample.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+	const float PI = 3.14159265f;
+
+	float sinc(float x) {
+		if (std::abs(x) < 1e-6f) return 1.f;
+		x *= PI;
+		return std::sin(x) / x;
+	}
+
+	float filter_support(ResampleFilter filter) {
+		switch (filter) {
+		case FILTER_BOX: return .5f;
+		case FILTER_BILINEAR: return 1.f;
+		default: return 3.f;
+		}
+	}
+
+	float filter_weight(ResampleFilter filter, float x) {
+		switch (filter) {
+		case FILTER_BOX:
+			return x >= -.5f && x < .5f ? 1.f : 0.f;
+		case FILTER_BILINEAR:
+			x = std::abs(x);
+			return x < 1.f ? 1.f - x : 0.f;
+		default:
+			return std::abs(x) < 3.f ? sinc(x) * sinc(x / 3.f) : 0.f;
+		}
+	}
+
+	// source pixels contributing to each output pixel along one axis: count of them from first on, with
+	// their normalized weights taps apart; pixels past the edges are left out and the rest renormalized
+	struct Weights {
+		int taps;
+		std::vector<int> first, count;
+		std::vector<float> weights;
+
+		Weights(ResampleFilter filter, int srcSize, int dstSize) {
+			float scale = (float)srcSize / dstSize;
+			float filterScale = std::max(scale, 1.f);
+			float support = filter_support(filter) * filterScale;
+			taps = (int)std::ceil(support) * 2 + 1;
+			first.resize(dstSize);
+			count.resize(dstSize);
+			weights.assign(dstSize * taps, 0.f);
+			for (int i = 0; i < dstSize; i++) {
+				float center = (i + .5f) * scale;
+				int lo = std::max((int)std::floor(center - support + .5f), 0);
+				int hi = std::min(std::min((int)std::floor(center + support + .5f), srcSize), lo + taps);
+				float* w = &weights[i * taps];
+				float total = 0;
+				for (int x = lo; x < hi; x++)
+					total += w[x - lo] = filter_weight(filter, (x - center + .5f) / filterScale);
+				if (hi <= lo || total == 0) {
+					// nothing under the filter, take the nearest pixel
+					std::fill(w, w + taps, 0.f);
+					lo = std::min((int)center, srcSize - 1);
+					hi = lo + 1;
+					w[0] = total = 1;
+				}
+				for (int x = lo; x < hi; x++)
+					w[x - lo] /= total;
+				first[i] = lo;
+				count[i] = hi - lo;
+			}
+		}
+	};
+
+	// sRGB transfer both ways; linear values index the encoding table at 12 bits, which still tells apart
+	// the darkest levels
+	struct GammaTables {
+		static const int ENCODE_SIZE = 4096;
+		float toLinear[256];
+		unsigned char toSRGB[ENCODE_SIZE];
+
+		GammaTables() {
+			for (int i = 0; i < 256; i++) {
+				float c = i / 255.f;
+				toLinear[i] = c <= .04045f ? c / 12.92f : std::pow((c + .055f) / 1.055f, 2.4f);
+			}
+			for (int i = 0; i < ENCODE_SIZE; i++) {
+				float c = i / (ENCODE_SIZE - 1.f);
+				c = c <= .0031308f ? c * 12.92f : 1.055f * std::pow(c, 1 / 2.4f) - .055f;
+				toSRGB[i] = (unsigned char)std::min(255, (int)(c * 255 + .5f));
+			}
+		}
+	};
+
+	const GammaTables& gamma_tables() {
+		static const GammaTables tables;
+		return tables;
+	}
+
+	struct Output {
+		TGAImage* image;
+		Weights horizontal, vertical;
+		std::vector<float> rows; // every source row after the horizontal pass, four floats per output pixel
+
+		Output(TGAImage* img, ResampleFilter filter, int srcWidth, int srcHeight) : image(img),
+			horizontal(filter, srcWidth, img->get_width()), vertical(filter, srcHeight, img->get_height()),
+			rows((size_t)srcHeight * img->get_width() * 4) {}
+	};
+
+	// four floats per pixel whatever the format, so that a pixel fits one SSE register; with gamma the
+	// color channels come out in linear light from 0 to 1, alpha always stays from 0 to 255
+	void decode_row(const unsigned char* src, int width, int bytespp, bool gamma, float* dst) {
+		const GammaTables& tables = gamma_tables();
+		int colors = bytespp == TGAImage::RGBA ? 3 : bytespp;
+		for (int i = 0; i < width; i++, src += bytespp, dst += 4) {
+			for (int c = 0; c < 4; c++)
+				dst[c] = c >= bytespp ? 0.f : gamma && c < colors ? tables.toLinear[src[c]] : src[c];
+		}
+	}
+
+	void encode_row(const float* src, int width, int bytespp, bool gamma, unsigned char* dst) {
+		const GammaTables& tables = gamma_tables();
+		int colors = bytespp == TGAImage::RGBA ? 3 : bytespp;
+		for (int i = 0; i < width; i++, src += 4, dst += bytespp) {
+			for (int c = 0; c < bytespp; c++) {
+				if (gamma && c < colors) {
+					int index = (int)(src[c] * (GammaTables::ENCODE_SIZE - 1) + .5f);
+					dst[c] = tables.toSRGB[std::min(std::max(index, 0), GammaTables::ENCODE_SIZE - 1)];
+				} else {
+					dst[c] = (unsigned char)std::min(std::max((int)(src[c] + .5f), 0), 255);
+				}
+			}
+		}
+	}
+
+	void filter_row(const float* src, const Weights& weights, int width, float* dst) {
+		for (int i = 0; i < width; i++) {
+			const float* w = &weights.weights[i * weights.taps];
+			const float* p = src + weights.first[i] * 4;
+			int n = weights.count[i];
+#ifdef RESAMPLE_SSE2
+			__m128 acc = _mm_setzero_ps();
+			for (int k = 0; k < n; k++)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(p + k * 4)));
+			_mm_storeu_ps(dst + i * 4, acc);
+#else
+			float acc[4] = { 0, 0, 0, 0 };
+			for (int k = 0; k < n; k++)
+				for (int c = 0; c < 4; c++) acc[c] += w[k] * p[k * 4 + c];
+			for (int c = 0; c < 4; c++) dst[i * 4 + c] = acc[c];
+#endif
+		}
+	}
+
+	// one output row from the rows of the horizontal pass, a row at a time so that memory is read in order
+	void filter_column(const Output& output, int y, float* dst) {
+		int n = output.image->get_width() * 4;
+		const float* w = &output.vertical.weights[y * output.vertical.taps];
+		const float* rows = &output.rows[(size_t)output.vertical.first[y] * n];
+		std::fill(dst, dst + n, 0.f);
+		for (int k = 0; k < output.vertical.count[y]; k++, rows += n) {
+#ifdef RESAMPLE_SSE2
+			__m128 weight = _mm_set1_ps(w[k]);
+			for (int i = 0; i < n; i += 4)
+				_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(weight, _mm_loadu_ps(rows + i))));
+#else
+			for (int i = 0; i < n; i++)
+				dst[i] += w[k] * rows[i];
+#endif
+		}
+	}
+
+	// rows 0 to rows - 1 cut into one band per thread, the first band on the calling thread
+	void run_bands(int rows, int threads, const std::function<void(int, int)>& band) {
+		// bands of only a few rows cost more to start than they save
+		int n = std::max(1, std::min(threads, rows / 16));
+		std::vector<std::thread> workers;
+		for (int t = 1; t < n; t++)
+			workers.push_back(std::thread(band, rows * t / n, rows * (t + 1) / n));
+		band(0, rows / n);
+		for (int t = 0; t < (int)workers.size(); t++)
+			workers[t].join();
+	}
+}
+
+bool resample(TGAImage& source, const std::vector<Vec2i>& sizes, std::vector<TGAImage>& outputs, const ResampleOptions& options) {
+	int width = source.get_width(), height = source.get_height(), bytespp = source.get_bytespp();
+	if (!source.buffer() || width <= 0 || height <= 0) {
+		std::cerr << "can't resample an empty image\n";
+		return false;
+	}
+	for (int k = 0; k < (int)sizes.size(); k++) {
+		if (sizes[k].x <= 0 || sizes[k].y <= 0) {
+			std::cerr << "can't resample to " << sizes[k].x << "x" << sizes[k].y << "\n";
+			return false;
+		}
+	}
+	int threads = options.threads > 0 ? options.threads : std::max(1, (int)std::thread::hardware_concurrency());
+
+	outputs.clear();
+	outputs.reserve(sizes.size());
+	std::vector<Output> jobs;
+	jobs.reserve(sizes.size());
+	for (int k = 0; k < (int)sizes.size(); k++) {
+		outputs.push_back(TGAImage(sizes[k].x, sizes[k].y, bytespp));
+		jobs.push_back(Output(&outputs.back(), options.filter, width, height));
+	}
+
+	// horizontal pass, bands of source rows
+	run_bands(height, threads, [&](int y0, int y1) {
+		std::vector<float> line((size_t)width * 4);
+		for (int y = y0; y < y1; y++) {
+			decode_row(source.buffer() + (size_t)y * width * bytespp, width, bytespp, options.gamma, &line[0]);
+			for (int k = 0; k < (int)jobs.size(); k++) {
+				int w = jobs[k].image->get_width();
+				filter_row(&line[0], jobs[k].horizontal, w, &jobs[k].rows[(size_t)y * w * 4]);
+			}
+		}
+	});
+
+	// vertical pass, bands over the rows of all outputs one after the other
+	int total = 0;
+	for (int k = 0; k < (int)jobs.size(); k++)
+		total += jobs[k].image->get_height();
+	run_bands(total, threads, [&](int r0, int r1) {
+		std::vector<float> line;
+		int base = 0;
+		for (int k = 0; k < (int)jobs.size(); k++) {
+			TGAImage& image = *jobs[k].image;
+			int w = image.get_width(), h = image.get_height();
+			line.resize((size_t)w * 4);
+			for (int y = std::max(r0 - base, 0); y < std::min(r1 - base, h); y++) {
+				filter_column(jobs[k], y, &line[0]);
+				encode_row(&line[0], w, bytespp, options.gamma, image.buffer() + (size_t)y * w * bytespp);
+			}
+			base += h;
+		}
+	});
+	return true;
+}
+
+bool resample(TGAImage& source, int width, int height, TGAImage& output, const ResampleOptions& options) {
+	std::vector<TGAImage> outputs;
+	if (!resample(source, std::vector<Vec2i>(1, Vec2i(width, height)), outputs, options))
+		return false;
+	output = std::move(outputs[0]);
+	return true;
+}
@@ -0,0 +1,32 @@
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+
+enum ResampleFilter {
+	FILTER_BOX,      // average of the source pixels under the output pixel
+	FILTER_BILINEAR, // tent, plain linear interpolation when magnifying
+	FILTER_LANCZOS3  // windowed sinc over three lobes, the sharpest of the three, rings a little at hard edges
+};
+
+struct ResampleOptions {
+	ResampleFilter filter;
+	bool gamma;  // filter in linear light: color channels are decoded from sRGB first and encoded again after
+	int threads; // bands of rows processed at the same time, 0 for one per hardware thread
+
+	ResampleOptions(ResampleFilter f = FILTER_LANCZOS3, bool g = false, int t = 0) : filter(f), gamma(g), threads(t) {}
+};
+
+// Separable resampling. The weights of every output column and row are computed once up front; the source
+// rows are filtered horizontally into a float buffer, and its columns vertically into the output. Both
+// passes work on a whole pixel (four floats) per instruction and are split into bands of rows over threads.
+// When scaling down the filter widens with the scale factor, so that every source pixel contributes and
+// nothing aliases. Any number of output sizes come from one run: each source row is converted once and
+// goes through the horizontal pass of every output while it is at hand.
+bool resample(TGAImage& source, const std::vector<Vec2i>& sizes, std::vector<TGAImage>& outputs,
+              const ResampleOptions& options = ResampleOptions());
+bool resample(TGAImage& source, int width, int height, TGAImage& output, const ResampleOptions& options = ResampleOptions());
+
+#endif //__RESAMPLE_H__
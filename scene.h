@@ -0,0 +1,25 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include "geometry.h"
+#include "model.h"
+
+// one placement of a model in the world: uniform scale followed by a translation; lod picks the level of
+// detail of the model that gets drawn, all levels share the vertices of the model
+struct Instance {
+	Model* model;
+	Vec3f offset;
+	float scale;
+	int lod;
+
+	Instance(Model* m, Vec3f o = Vec3f(), float s = 1.f) : model(m), offset(o), scale(s), lod(0) {}
+	Model* mesh() { return model->lod(lod); }
+	Vec3f world(int ivert) { return model->vert(ivert) * scale + offset; }
+	void bounds(Vec3f& lo, Vec3f& hi) {
+		model->bounds(lo, hi);
+		lo = lo * scale + offset;
+		hi = hi * scale + offset;
+	}
+};
+
+#endif //__SCENE_H__
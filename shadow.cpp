@@ -0,0 +1,67 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "shadow.h"
+#include "raster.h"
+
+ShadowMap::ShadowMap(int size, Vec3f light_dir, float bias, float ambient) :
+    depth_(size * size, -std::numeric_limits<float>::max()), size_(size), dir_(light_dir), origin_(), scale_(1.f), bias_(bias), ambient_(ambient) {
+    dir_.normalize();
+    // any vector not parallel to the light works to span the image plane
+    Vec3f up = std::abs(dir_.y) < .9f ? Vec3f(0, 1, 0) : Vec3f(1, 0, 0);
+    u_ = (up ^ dir_).normalize();
+    v_ = dir_ ^ u_;
+}
+
+void ShadowMap::render(std::vector<Instance>& instances) {
+    // fit the projection to the scene with a one pixel margin for the PCF kernel
+    Vec2f lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+    for (int k = 0; k < (int)instances.size(); k++) {
+        for (int i = 0; i < instances[k].model->nverts(); i++) {
+            Vec3f v = instances[k].world(i);
+            float x = v * u_, y = v * v_;
+            lo.x = std::min(lo.x, x); lo.y = std::min(lo.y, y);
+            hi.x = std::max(hi.x, x); hi.y = std::max(hi.y, y);
+        }
+    }
+    origin_ = lo;
+    scale_ = (size_ - 3) / std::max(std::max(hi.x - lo.x, hi.y - lo.y), 1e-6f);
+
+    std::fill(depth_.begin(), depth_.end(), -std::numeric_limits<float>::max());
+    for (int k = 0; k < (int)instances.size(); k++) {
+        Model* model = instances[k].mesh();
+        for (int i = 0; i < model->nfaces(); i++) {
+            Vec3f t[3];
+            for (int j = 0; j < 3; j++) {
+                t[j] = to_light(instances[k].world(model->face_vert(i, j)));
+                // the rasterizer expects vertices on the pixel grid
+                t[j].x = std::floor(t[j].x + .5f);
+                t[j].y = std::floor(t[j].y + .5f);
+            }
+            depth_triangle(t, &depth_[0], size_, size_);
+        }
+    }
+}
+
+Vec3f ShadowMap::to_light(Vec3f world) {
+    return Vec3f((world * u_ - origin_.x) * scale_ + 1, (world * v_ - origin_.y) * scale_ + 1, -(world * dir_));
+}
+
+// percentage closer filtering over a 3x3 footprint, 1 is fully lit
+float ShadowMap::lit(Vec3f light_coords) {
+    int x = (int)light_coords.x, y = (int)light_coords.y;
+    int count = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            int sx = std::min(std::max(x + dx, 0), size_ - 1);
+            int sy = std::min(std::max(y + dy, 0), size_ - 1);
+            if (light_coords.z + bias_ >= depth_[sx + sy * size_])
+                count++;
+        }
+    }
+    return count / 9.f;
+}
+
+float ShadowMap::shade(Vec3f light_coords) {
+    return ambient_ + (1 - ambient_) * lit(light_coords);
+}
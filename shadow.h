@@ -0,0 +1,29 @@
+#ifndef __SHADOW_H__
+#define __SHADOW_H__
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "scene.h"
+
+// Depth map rendered from a directional light with an orthographic projection fitted to the model.
+// Light space coordinates are in shadow map pixels, z grows towards the light like the main z buffer.
+class ShadowMap {
+private:
+	std::vector<float> depth_;
+	int size_;
+	Vec3f dir_;
+	Vec3f u_, v_;
+	Vec2f origin_;
+	float scale_;
+	float bias_;
+	float ambient_;
+public:
+	ShadowMap(int size, Vec3f light_dir, float bias = .02f, float ambient = .4f);
+	void render(std::vector<Instance>& instances);
+	Vec3f to_light(Vec3f world);
+	float lit(Vec3f light_coords);
+	float shade(Vec3f light_coords);
+};
+
+#endif //__SHADOW_H__
@@ -0,0 +1,284 @@
+#include <cmath>
+#include <queue>
+#include <iostream>
+#include <algorithm>
+#include "simplify.h"
+
+namespace {
+	// weight of the planes across seam and border edges against the planes of the faces
+	const double EDGE_WEIGHT = 10.;
+	// a collapse may turn no face further than this from where it faced, as the cosine of the angle
+	const float MIN_FACE_TURN = .2f;
+
+	// sum of squared distances to a set of planes, the symmetric 4x4 matrix stored as its upper triangle
+	struct Quadric {
+		double a[10];
+
+		Quadric() {
+			for (int i = 0; i < 10; i++) a[i] = 0;
+		}
+		void add_plane(Vec3f n, float d, double w) {
+			double p[4] = { n.x, n.y, n.z, d };
+			int k = 0;
+			for (int i = 0; i < 4; i++)
+				for (int j = i; j < 4; j++)
+					a[k++] += w * p[i] * p[j];
+		}
+		void add(const Quadric& q) {
+			for (int i = 0; i < 10; i++) a[i] += q.a[i];
+		}
+		double error(Vec3f v) const {
+			double p[4] = { v.x, v.y, v.z, 1. };
+			double e = 0;
+			int k = 0;
+			for (int i = 0; i < 4; i++)
+				for (int j = i; j < 4; j++)
+					e += (i == j ? 1. : 2.) * a[k++] * p[i] * p[j];
+			return std::max(e, 0.);
+		}
+	};
+
+	// collapse of vertex from onto vertex to; stamps tell whether either has changed since the cost was taken
+	struct Collapse {
+		double cost;
+		int from, to;
+		unsigned int stampFrom, stampTo;
+		bool operator<(const Collapse& c) const { return cost > c.cost; } // cheapest on top
+	};
+
+	class Simplifier {
+	private:
+		const std::vector<Vec3f>& verts_;
+		std::vector<std::vector<Vec3i> > faces_;
+		std::vector<bool> alive_;
+		int aliveCount_;
+		std::vector<std::vector<int> > vertFaces_; // faces around every vertex, dead ones included
+		std::vector<Quadric> quadrics_;
+		std::vector<unsigned int> stamps_;
+		std::priority_queue<Collapse> queue_;
+		std::vector<Vec3f> faceNormals_;
+		std::vector<float> faceOffsets_;
+		std::vector<std::vector<int> > planes_; // original faces every vertex stands for, sorted
+		float maxDistance_;
+
+		int corner(int face, int vert) const {
+			for (int j = 0; j < 3; j++)
+				if (faces_[face][j].ivert == vert) return j;
+			return -1;
+		}
+		Vec3f normal(Vec3f a, Vec3f b, Vec3f c) const {
+			Vec3f n = (b - a) ^ (c - a);
+			float len = n.norm();
+			return len > 0 ? n * (1.f / len) : Vec3f();
+		}
+		void push(int from, int to) {
+			Quadric q = quadrics_[from];
+			q.add(quadrics_[to]);
+			Collapse c = { q.error(verts_[to]), from, to, stamps_[from], stamps_[to] };
+			queue_.push(c);
+		}
+		void neighbours(int v, std::vector<int>& out) const {
+			out.clear();
+			for (int k = 0; k < (int)vertFaces_[v].size(); k++) {
+				int f = vertFaces_[v][k];
+				if (!alive_[f]) continue;
+				for (int j = 0; j < 3; j++)
+					if (faces_[f][j].ivert != v) out.push_back(faces_[f][j].ivert);
+			}
+			std::sort(out.begin(), out.end());
+			out.erase(std::unique(out.begin(), out.end()), out.end());
+		}
+		// furthest the vertex is from the plane of any original face it stands for
+		float distance(int v) const {
+			float d = 0;
+			for (int k = 0; k < (int)planes_[v].size(); k++) {
+				int f = planes_[v][k];
+				d = std::max(d, std::abs(faceNormals_[f] * verts_[v] + faceOffsets_[f]));
+			}
+			return d;
+		}
+		bool try_collapse(int from, int to);
+	public:
+		Simplifier(const std::vector<Vec3f>& verts, const std::vector<std::vector<Vec3i> >& faces);
+		int faces() const { return aliveCount_; }
+		// how far the surface has moved from the original faces; unlike the quadric costs this leaves out
+		// the planes across seams and borders, which only weigh the order of the collapses
+		float error() const { return maxDistance_; }
+		void run(int target);
+		void level(LodLevel& level) const;
+	};
+
+	Simplifier::Simplifier(const std::vector<Vec3f>& verts, const std::vector<std::vector<Vec3i> >& faces) : verts_(verts),
+		faces_(faces), alive_(faces.size(), true), aliveCount_((int)faces.size()), vertFaces_(verts.size()),
+		quadrics_(verts.size()), stamps_(verts.size(), 0), queue_(), faceNormals_(faces.size()), faceOffsets_(faces.size()),
+		maxDistance_(0) {
+		for (int f = 0; f < (int)faces_.size(); f++) {
+			Vec3f a = verts_[faces_[f][0].ivert], b = verts_[faces_[f][1].ivert], c = verts_[faces_[f][2].ivert];
+			Vec3f n = normal(a, b, c);
+			faceNormals_[f] = n;
+			faceOffsets_[f] = -(n * a);
+			for (int j = 0; j < 3; j++) {
+				vertFaces_[faces_[f][j].ivert].push_back(f);
+				quadrics_[faces_[f][j].ivert].add_plane(n, -(n * a), 1.);
+			}
+		}
+		planes_ = vertFaces_;
+
+		// an edge is a border when only one face has it, a seam when its two faces disagree on its uvs
+		for (int f = 0; f < (int)faces_.size(); f++) {
+			for (int j = 0; j < 3; j++) {
+				const Vec3i& p = faces_[f][j];
+				const Vec3i& q = faces_[f][(j + 1) % 3];
+				int others = 0;
+				bool seam = false;
+				for (int k = 0; k < (int)vertFaces_[p.ivert].size(); k++) {
+					int g = vertFaces_[p.ivert][k];
+					int cp = corner(g, p.ivert), cq = corner(g, q.ivert);
+					if (g == f || cq < 0) continue;
+					others++;
+					seam = seam || faces_[g][cp].iuv != p.iuv || faces_[g][cq].iuv != q.iuv;
+				}
+				if (others == 1 && !seam) continue;
+				Vec3f a = verts_[p.ivert], b = verts_[q.ivert];
+				Vec3f across = (b - a) ^ normal(verts_[faces_[f][0].ivert], verts_[faces_[f][1].ivert], verts_[faces_[f][2].ivert]);
+				float len = across.norm();
+				if (len == 0) continue;
+				across = across * (1.f / len);
+				quadrics_[p.ivert].add_plane(across, -(across * a), EDGE_WEIGHT);
+				quadrics_[q.ivert].add_plane(across, -(across * a), EDGE_WEIGHT);
+			}
+		}
+
+		for (int f = 0; f < (int)faces_.size(); f++) {
+			for (int j = 0; j < 3; j++) {
+				push(faces_[f][j].ivert, faces_[f][(j + 1) % 3].ivert);
+				push(faces_[f][(j + 1) % 3].ivert, faces_[f][j].ivert);
+			}
+		}
+	}
+
+	bool Simplifier::try_collapse(int from, int to) {
+		// every uv (and normal) of from has to have a counterpart on to, found across the faces both share
+		std::vector<std::pair<int, int> > uvMap, normalMap;
+		std::vector<int> shared, opposite;
+		for (int k = 0; k < (int)vertFaces_[from].size(); k++) {
+			int f = vertFaces_[from][k];
+			int cf = corner(f, from), ct = corner(f, to);
+			if (!alive_[f] || ct < 0) continue;
+			shared.push_back(f);
+			opposite.push_back(faces_[f][3 - cf - ct].ivert);
+			uvMap.push_back(std::make_pair(faces_[f][cf].iuv, faces_[f][ct].iuv));
+			normalMap.push_back(std::make_pair(faces_[f][cf].inorm, faces_[f][ct].inorm));
+		}
+		if (shared.empty()) return false;
+		for (int i = 0; i < (int)uvMap.size(); i++)
+			for (int j = 0; j < i; j++)
+				if (uvMap[i].first == uvMap[j].first && uvMap[i].second != uvMap[j].second) return false;
+
+		for (int k = 0; k < (int)vertFaces_[from].size(); k++) {
+			int f = vertFaces_[from][k];
+			if (!alive_[f] || std::find(shared.begin(), shared.end(), f) != shared.end()) continue;
+			int cf = corner(f, from);
+			bool mapped = false;
+			for (int i = 0; i < (int)uvMap.size() && !mapped; i++)
+				mapped = uvMap[i].first == faces_[f][cf].iuv;
+			if (!mapped) return false;
+			// the face must not fold over once from sits where to is
+			Vec3f p[3], q[3];
+			for (int j = 0; j < 3; j++)
+				p[j] = q[j] = verts_[faces_[f][j].ivert];
+			q[cf] = verts_[to];
+			Vec3f before = normal(p[0], p[1], p[2]), after = normal(q[0], q[1], q[2]);
+			if (after * after == 0 || before * after < MIN_FACE_TURN) return false;
+		}
+
+		// vertices next to both may only be the ones across the shared faces, or the surface gets pinched
+		std::vector<int> around, aroundTo;
+		neighbours(from, around);
+		neighbours(to, aroundTo);
+		std::sort(opposite.begin(), opposite.end());
+		opposite.erase(std::unique(opposite.begin(), opposite.end()), opposite.end());
+		std::vector<int> common;
+		std::set_intersection(around.begin(), around.end(), aroundTo.begin(), aroundTo.end(), std::back_inserter(common));
+		if (common != opposite) return false;
+
+		for (int k = 0; k < (int)vertFaces_[from].size(); k++) {
+			int f = vertFaces_[from][k];
+			if (!alive_[f]) continue;
+			if (std::find(shared.begin(), shared.end(), f) != shared.end()) {
+				alive_[f] = false;
+				aliveCount_--;
+				continue;
+			}
+			Vec3i& c = faces_[f][corner(f, from)];
+			for (int i = 0; i < (int)uvMap.size(); i++) {
+				if (uvMap[i].first == c.iuv) {
+					c.iuv = uvMap[i].second;
+					break;
+				}
+			}
+			for (int i = 0; i < (int)normalMap.size(); i++) {
+				if (normalMap[i].first == c.inorm) {
+					c.inorm = normalMap[i].second;
+					break;
+				}
+			}
+			c.ivert = to;
+			vertFaces_[to].push_back(f);
+		}
+		vertFaces_[from].clear();
+		quadrics_[to].add(quadrics_[from]);
+		std::vector<int> merged;
+		std::set_union(planes_[to].begin(), planes_[to].end(), planes_[from].begin(), planes_[from].end(), std::back_inserter(merged));
+		planes_[to].swap(merged);
+		std::vector<int>().swap(planes_[from]);
+		maxDistance_ = std::max(maxDistance_, distance(to));
+		stamps_[from]++;
+		stamps_[to]++;
+
+		neighbours(to, around);
+		for (int i = 0; i < (int)around.size(); i++) {
+			push(to, around[i]);
+			push(around[i], to);
+		}
+		return true;
+	}
+
+	// collapses the cheapest edges until at most target faces are left or nothing can go any more
+	void Simplifier::run(int target) {
+		while (aliveCount_ > target && !queue_.empty()) {
+			Collapse c = queue_.top();
+			queue_.pop();
+			if (c.stampFrom != stamps_[c.from] || c.stampTo != stamps_[c.to] || vertFaces_[c.from].empty()) continue;
+			try_collapse(c.from, c.to);
+		}
+	}
+
+	void Simplifier::level(LodLevel& level) const {
+		level.faces.clear();
+		for (int f = 0; f < (int)faces_.size(); f++)
+			if (alive_[f]) level.faces.push_back(faces_[f]);
+		level.error = error();
+	}
+}
+
+std::vector<LodLevel> simplify(const std::vector<Vec3f>& verts, const std::vector<std::vector<Vec3i> >& faces, float ratio, int minFaces) {
+	std::vector<LodLevel> levels;
+	for (int f = 0; f < (int)faces.size(); f++) {
+		if (faces[f].size() != 3) {
+			std::cerr << "can't simplify a mesh that is not all triangles\n";
+			return levels;
+		}
+	}
+	Simplifier simplifier(verts, faces);
+	int last = (int)faces.size();
+	while (last > minFaces) {
+		simplifier.run(std::max((int)(last * ratio), minFaces));
+		// a level that hardly differs from the one before is not worth keeping, nor is going on
+		if (simplifier.faces() > last * (1 + ratio) / 2) break;
+		levels.push_back(LodLevel());
+		simplifier.level(levels.back());
+		last = simplifier.faces();
+	}
+	return levels;
+}
@@ -0,0 +1,23 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+#include <vector>
+#include "geometry.h"
+
+// one level of a simplified mesh: triangles whose corners (vertex, uv, normal) index the arrays of the
+// original mesh, and how far the level may stray from it
+struct LodLevel {
+	std::vector<std::vector<Vec3i> > faces;
+	float error; // in model units
+};
+
+// Chain of ever coarser versions of a triangle mesh, each with about ratio times the faces of the one
+// before, down to minFaces or until the mesh cannot be simplified any further. Edges are collapsed in order
+// of their quadric error (Garland and Heckbert), always onto one of their two vertices, so no vertex or uv
+// is ever made up. A collapse has to keep every uv the vertex had on a matching uv of the vertex it merges
+// into, which keeps texture seams in place; seam and border edges also add planes across them to their
+// quadrics so that their shape holds. Collapses that would fold a face over or pinch the surface are skipped.
+std::vector<LodLevel> simplify(const std::vector<Vec3f>& verts, const std::vector<std::vector<Vec3i> >& faces,
+                               float ratio = .5f, int minFaces = 64);
+
+#endif //__SIMPLIFY_H__
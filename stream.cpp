@@ -0,0 +1,279 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include "stream.h"
+#include "model.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char SOUP_MAGIC[4] = { 'T', 'R', 'I', 'S' };
+static const int SOUP_VERSION = 1;
+static const size_t PAGE = 4096;
+
+// wavefront obj indices start at 1, negative ones count back from the last of the count elements read so
+// far; -1 when the index is out of range
+static long obj_index(long i, size_t count) {
+	if (i < 0) i += (long)count + 1;
+	return i >= 1 && i <= (long)count ? i - 1 : -1;
+}
+
+MeshStream::MeshStream(const char* filename, int chunkSize) : chunkSize_(std::max(chunkSize, 1)), soup_(true), total_(0), produced_(0),
+	consumer_(0), started_(false), done_(false), stop_(false), map_(NULL), mapSize_(0), fd_(-1), badFaces_(0) {
+	std::string name(filename);
+	soup_ = !(name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0);
+	if (!soup_) {
+		in_.open(filename, std::ifstream::in);
+		if (in_.fail()) {
+			std::cerr << "can't open file " << filename << "\n";
+			return;
+		}
+		texture_ = Model::texture_path(name, "_diffuse.tga");
+		total_ = -1; // unknown until the end of the file
+	} else {
+		SoupHeader header;
+#ifndef _WIN32
+		fd_ = open(filename, O_RDONLY);
+		struct stat st;
+		if (fd_ >= 0 && fstat(fd_, &st) == 0 && (size_t)st.st_size >= sizeof(header)) {
+			mapSize_ = st.st_size;
+			void* p = mmap(NULL, mapSize_, PROT_READ, MAP_SHARED, fd_, 0);
+			if (p != MAP_FAILED) {
+				map_ = (const unsigned char*)p;
+				madvise(p, mapSize_, MADV_SEQUENTIAL);
+			}
+		}
+		if (map_) {
+			memcpy(&header, map_, sizeof(header));
+		} else
+#endif
+		{
+			in_.open(filename, std::ios::binary);
+			in_.read((char*)&header, sizeof(header));
+			if (!in_.good()) {
+				std::cerr << "can't open file " << filename << "\n";
+				return;
+			}
+		}
+		if (memcmp(header.magic, SOUP_MAGIC, 4) || header.version != SOUP_VERSION || header.count < 0 ||
+			(map_ && (size_t)header.count > (mapSize_ - sizeof(header)) / sizeof(SoupTriangle))) {
+			std::cerr << "bad triangle soup file " << filename << "\n";
+			in_.close();
+			return;
+		}
+		header.texture[sizeof(header.texture) - 1] = '\0';
+		texture_ = header.texture;
+		total_ = header.count;
+	}
+	io_ = std::thread(&MeshStream::io_loop, this);
+}
+
+MeshStream::~MeshStream() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cond_.notify_all();
+	if (io_.joinable()) io_.join();
+#ifndef _WIN32
+	if (map_) munmap((void*)map_, mapSize_);
+	if (fd_ >= 0) close(fd_);
+#endif
+}
+
+bool MeshStream::is_open() {
+	return io_.joinable();
+}
+
+// number of triangles, -1 for OBJ input where it is only known at the end
+long long MeshStream::size() {
+	return total_;
+}
+
+std::string MeshStream::texture() {
+	return texture_;
+}
+
+void MeshStream::io_loop() {
+	for (int slot = 0; ; slot ^= 1) {
+		Chunk& chunk = chunks_[slot];
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cond_.wait(lock, [&]() { return stop_ || !chunk.ready; });
+			if (stop_) return;
+		}
+		bool more = fill(chunk);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			chunk.ready = true;
+		}
+		cond_.notify_all();
+		if (!more) return;
+	}
+}
+
+// prepares the next chunk, an empty chunk marks the end of the mesh
+bool MeshStream::fill(Chunk& chunk) {
+	if (!soup_) return fill_obj(chunk);
+
+	long long n = std::min((long long)chunkSize_, total_ - produced_);
+	chunk.count = (int)n;
+	if (n <= 0) return false;
+#ifndef _WIN32
+	if (map_) {
+		chunk.tris = (const SoupTriangle*)(map_ + sizeof(SoupHeader)) + produced_;
+		// fault the pages in here so that the renderer never waits on the disk
+		size_t begin = (size_t)((const unsigned char*)chunk.tris - map_) / PAGE * PAGE;
+		size_t end = std::min(mapSize_, (size_t)((const unsigned char*)(chunk.tris + n) - map_));
+		madvise((void*)(map_ + begin), end - begin, MADV_WILLNEED);
+		volatile unsigned char sink = 0;
+		for (size_t p = begin; p < end; p += PAGE)
+			sink ^= map_[p];
+		(void)sink;
+		produced_ += n;
+		return true;
+	}
+#endif
+	chunk.storage.resize(n);
+	in_.read((char*)&chunk.storage[0], n * sizeof(SoupTriangle));
+	n = in_.gcount() / sizeof(SoupTriangle);
+	chunk.tris = &chunk.storage[0];
+	chunk.count = (int)n;
+	produced_ += n;
+	return n > 0;
+}
+
+// reads lines until the chunk is full; polygons are split into fans
+bool MeshStream::fill_obj(Chunk& chunk) {
+	chunk.storage.clear();
+	chunk.storage.reserve(chunkSize_);
+	std::string line;
+	while ((int)chunk.storage.size() < chunkSize_ && std::getline(in_, line)) {
+		const char* s = line.c_str();
+		char* end;
+		if (!line.compare(0, 2, "v ")) {
+			Vec3f v;
+			s += 1;
+			for (int i = 0; i < 3; i++, s = end) v.raw[i] = strtof(s, &end);
+			verts_.push_back(v);
+		} else if (!line.compare(0, 3, "vt ")) {
+			Vec2f uv;
+			s += 2;
+			for (int i = 0; i < 2; i++, s = end) uv.raw[i] = strtof(s, &end);
+			uv_.push_back(uv);
+		} else if (!line.compare(0, 2, "f ")) {
+			s += 1;
+			std::vector<SoupVertex> poly;
+			bool bad = false;
+			for (;;) {
+				long iv = strtol(s, &end, 10);
+				if (end == s) break;
+				s = end;
+				long it = 0;
+				if (*s == '/') {
+					it = strtol(s + 1, &end, 10);
+					s = end;
+				}
+				while (*s && *s != ' ' && *s != '\t') s++; // skip the normal index
+				iv = obj_index(iv, verts_.size());
+				it = it ? obj_index(it, uv_.size()) : -1;
+				bad = bad || iv < 0;
+				if (bad) continue;
+				SoupVertex v;
+				v.x = verts_[iv].x; v.y = verts_[iv].y; v.z = verts_[iv].z;
+				v.u = it >= 0 ? uv_[it].x : 0.f;
+				v.v = it >= 0 ? uv_[it].y : 0.f;
+				poly.push_back(v);
+			}
+			if (bad) {
+				badFaces_++;
+				continue;
+			}
+			for (int i = 1; i + 1 < (int)poly.size(); i++) {
+				SoupTriangle t;
+				t.v[0] = poly[0];
+				t.v[1] = poly[i];
+				t.v[2] = poly[i + 1];
+				chunk.storage.push_back(t);
+			}
+		}
+	}
+	chunk.count = (int)chunk.storage.size();
+	chunk.tris = chunk.count ? &chunk.storage[0] : NULL;
+	produced_ += chunk.count;
+	if (!chunk.count) {
+		total_ = produced_;
+		if (badFaces_)
+			std::cerr << badFaces_ << " faces with a vertex index out of range skipped\n";
+	}
+	return chunk.count > 0;
+}
+
+// hands the pages of a consumed chunk back to the kernel
+void MeshStream::release(Chunk& chunk) {
+#ifndef _WIN32
+	if (map_ && chunk.count > 0) {
+		size_t begin = ((size_t)((const unsigned char*)chunk.tris - map_) + PAGE - 1) / PAGE * PAGE;
+		size_t end = (size_t)((const unsigned char*)(chunk.tris + chunk.count) - map_) / PAGE * PAGE;
+		if (end > begin)
+			madvise((void*)(map_ + begin), end - begin, MADV_DONTNEED);
+	}
+#endif
+	(void)chunk;
+}
+
+// blocks until the I/O thread has the next chunk ready, false once the mesh is exhausted
+bool MeshStream::next(const SoupTriangle*& tris, int& count) {
+	if (done_ || !is_open()) return false;
+	if (started_) {
+		Chunk& previous = chunks_[consumer_];
+		release(previous);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			previous.ready = false;
+		}
+		cond_.notify_all();
+		consumer_ ^= 1;
+	}
+	started_ = true;
+
+	Chunk& chunk = chunks_[consumer_];
+	std::unique_lock<std::mutex> lock(mutex_);
+	cond_.wait(lock, [&]() { return chunk.ready; });
+	tris = chunk.tris;
+	count = chunk.count;
+	done_ = count == 0;
+	return !done_;
+}
+
+bool MeshStream::convert_obj(const char* objFile, const char* soupFile) {
+	MeshStream stream(objFile);
+	if (!stream.is_open()) return false;
+	std::ofstream out(soupFile, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << soupFile << "\n";
+		return false;
+	}
+	SoupHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SOUP_MAGIC, 4);
+	header.version = SOUP_VERSION;
+	strncpy(header.texture, stream.texture().c_str(), sizeof(header.texture) - 1);
+	out.write((char*)&header, sizeof(header));
+
+	const SoupTriangle* tris;
+	int count;
+	while (stream.next(tris, count)) {
+		out.write((const char*)tris, count * sizeof(SoupTriangle));
+		header.count += count;
+	}
+	out.seekp(0);
+	out.write((char*)&header, sizeof(header));
+	std::cerr << "# t# " << header.count << " written to " << soupFile << std::endl;
+	return out.good();
+}
@@ -0,0 +1,84 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <condition_variable>
+#include "geometry.h"
+
+struct SoupVertex {
+	float x, y, z;
+	float u, v;
+};
+
+struct SoupTriangle {
+	SoupVertex v[3];
+};
+
+// Header of a triangle soup file: self contained triangles with no shared vertex table,
+// so that any slice of the file can be rendered without the rest of it in memory.
+struct SoupHeader {
+	char magic[4];
+	int version;
+	long long count;
+	char texture[256];
+};
+
+// Reads a mesh a fixed number of triangles at a time while an I/O thread prepares the next chunk.
+// Triangle soup files are memory mapped, pages are prefetched ahead of the renderer and dropped once
+// their chunk is done, so memory stays bounded by two chunks whatever the size of the file. OBJ files
+// are read sequentially: faces are streamed, but the v/vt tables they index into have to stay resident.
+class MeshStream {
+private:
+	struct Chunk {
+		std::vector<SoupTriangle> storage;
+		const SoupTriangle* tris;
+		int count;
+		bool ready;
+		Chunk() : tris(NULL), count(0), ready(false) {}
+	};
+
+	int chunkSize_;
+	bool soup_;
+	std::string texture_;
+	std::atomic<long long> total_; // set by the I/O thread once an OBJ file runs out, read by size() at any time
+	long long produced_;
+	Chunk chunks_[2];
+	int consumer_;
+	bool started_;
+	bool done_;
+	bool stop_;
+	std::thread io_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+
+	// memory mapped soup
+	const unsigned char* map_;
+	size_t mapSize_;
+	int fd_;
+	// sequential readers
+	std::ifstream in_;
+	std::vector<Vec3f> verts_;
+	std::vector<Vec2f> uv_;
+	long long badFaces_; // faces dropped for a vertex index outside the vertices read so far
+
+	void io_loop();
+	bool fill(Chunk& chunk);
+	bool fill_obj(Chunk& chunk);
+	void release(Chunk& chunk);
+public:
+	MeshStream(const char* filename, int chunkSize = 1 << 16);
+	~MeshStream();
+	bool is_open();
+	long long size();
+	std::string texture();
+	bool next(const SoupTriangle*& tris, int& count);
+
+	static bool convert_obj(const char* objFile, const char* soupFile);
+};
+
+#endif //__STREAM_H__
@@ -3,7 +3,9 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <algorithm>
 #include "tgaimage.h"
+#include "resample.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -23,6 +25,11 @@ TGAImage::TGAImage(const TGAImage &img) {
 	memcpy(data, img.data, nbytes);
 }
 
+TGAImage::TGAImage(TGAImage &&img) : data(img.data), width(img.width), height(img.height), bytespp(img.bytespp) {
+	img.data = NULL;
+	img.width = img.height = img.bytespp = 0;
+}
+
 TGAImage::~TGAImage() {
 	if (data) delete [] data;
 }
@@ -40,6 +47,19 @@ TGAImage & TGAImage::operator =(const TGAImage &img) {
 	return *this;
 }
 
+TGAImage & TGAImage::operator =(TGAImage &&img) {
+	if (this != &img) {
+		if (data) delete [] data;
+		data    = img.data;
+		width   = img.width;
+		height  = img.height;
+		bytespp = img.bytespp;
+		img.data = NULL;
+		img.width = img.height = img.bytespp = 0;
+	}
+	return *this;
+}
+
 bool TGAImage::read_tga_file(const char *filename) {
 	if (data) delete [] data;
 	data = NULL;
@@ -267,6 +287,10 @@ int TGAImage::get_bytespp() {
 	return bytespp;
 }
 
+size_t TGAImage::memory_usage() {
+	return data ? (size_t)width*height*bytespp : 0;
+}
+
 int TGAImage::get_width() {
 	return width;
 }
@@ -292,16 +316,12 @@ bool TGAImage::flip_horizontally() {
 bool TGAImage::flip_vertically() {
 	if (!data) return false;
 	unsigned long bytes_per_line = width*bytespp;
-	unsigned char *line = new unsigned char[bytes_per_line];
 	int half = height>>1;
 	for (int j=0; j<half; j++) {
-		unsigned long l1 = j*bytes_per_line;
-		unsigned long l2 = (height-1-j)*bytes_per_line;
-		memmove((void *)line,      (void *)(data+l1), bytes_per_line);
-		memmove((void *)(data+l1), (void *)(data+l2), bytes_per_line);
-		memmove((void *)(data+l2), (void *)line,      bytes_per_line);
+		unsigned char *l1 = data + j*bytes_per_line;
+		unsigned char *l2 = data + (height-1-j)*bytes_per_line;
+		std::swap_ranges(l1, l1+bytes_per_line, l2); // in place, no line buffer to allocate
 	}
-	delete [] line;
 	return true;
 }
 
@@ -313,40 +333,12 @@ void TGAImage::clear() {
 	memset((void *)data, 0, width*height*bytespp);
 }
 
+// filtered with the default filter of resample(), so that scaling down does not alias
 bool TGAImage::scale(int w, int h) {
 	if (w<=0 || h<=0 || !data) return false;
-	unsigned char *tdata = new unsigned char[w*h*bytespp];
-	int nscanline = 0;
-	int oscanline = 0;
-	int erry = 0;
-	unsigned long nlinebytes = w*bytespp;
-	unsigned long olinebytes = width*bytespp;
-	for (int j=0; j<height; j++) {
-		int errx = width-w;
-		int nx   = -bytespp;
-		int ox   = -bytespp;
-		for (int i=0; i<width; i++) {
-			ox += bytespp;
-			errx += w;
-			while (errx>=(int)width) {
-				errx -= width;
-				nx += bytespp;
-				memcpy(tdata+nscanline+nx, data+oscanline+ox, bytespp);
-			}
-		}
-		erry += h;
-		oscanline += olinebytes;
-		while (erry>=(int)height) {
-			if (erry>=(int)height<<1) // it means we jump over a scanline
-				memcpy(tdata+nscanline+nlinebytes, tdata+nscanline, nlinebytes);
-			erry -= height;
-			nscanline += nlinebytes;
-		}
-	}
-	delete [] data;
-	data = tdata;
-	width = w;
-	height = h;
+	TGAImage scaled;
+	if (!resample(*this, w, h, scaled)) return false;
+	*this = std::move(scaled);
 	return true;
 }
 
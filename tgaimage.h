@@ -77,6 +77,7 @@ public:
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
 	TGAImage(const TGAImage &img);
+	TGAImage(TGAImage &&img);
 	bool read_tga_file(const char *filename);
 	bool write_tga_file(const char *filename, bool rle=true);
 	bool flip_horizontally();
@@ -86,9 +87,11 @@ public:
 	bool set(int x, int y, TGAColor c);
 	~TGAImage();
 	TGAImage & operator =(const TGAImage &img);
+	TGAImage & operator =(TGAImage &&img);
 	int get_width();
 	int get_height();
 	int get_bytespp();
+	size_t memory_usage();
 	unsigned char *buffer();
 	void clear();
 };
@@ -0,0 +1,169 @@
+#include <cstring>
+#include <algorithm>
+#include "tilebuffer.h"
+
+TileBuffer::TileBuffer(int width, int height, int bytespp, float clearDepth, int tileSize) : width_(width), height_(height),
+	bytespp_(bytespp), clearDepth_(clearDepth), tileSize_(tileSize), tilesX_((width + tileSize - 1) / tileSize),
+	tilesY_((height + tileSize - 1) / tileSize), tiles_(tilesX_ * tilesY_),
+	sparePixels_(tiles_.size(), std::vector<unsigned char>(tileSize * tileSize * bytespp)),
+	spareDepth_(tiles_.size(), std::vector<float>(tileSize * tileSize)) {
+	for (int i = 0; i < (int)tiles_.size(); i++) {
+		tiles_[i].colorMode = tiles_[i].depthMode = TILE_CLEAR;
+		tiles_[i].changed = true;
+	}
+}
+
+// pixel rectangle of a tile, upper corner exclusive, clipped to the screen
+void TileBuffer::rect(int tx, int ty, int& x0, int& y0, int& x1, int& y1) const {
+	x0 = tx * tileSize_; x1 = std::min(x0 + tileSize_, width_);
+	y0 = ty * tileSize_; y1 = std::min(y0 + tileSize_, height_);
+}
+
+// raw depth of a tile, rows tileSize apart, expanded from its compressed form on first access
+float* TileBuffer::depth(int tx, int ty) {
+	Tile& tile = this->tile(tx, ty);
+	if (tile.depthMode == TILE_RAW) return &tile.depth[0];
+	if (tile.depth.empty() && !spareDepth_.empty()) {
+		tile.depth.swap(spareDepth_.back());
+		spareDepth_.pop_back();
+	}
+	tile.depth.resize(tileSize_ * tileSize_);
+	int x0, y0, x1, y1;
+	rect(tx, ty, x0, y0, x1, y1);
+	for (int y = y0; y < y1; y++) {
+		float* row = &tile.depth[(y - y0) * tileSize_];
+		for (int x = x0; x < x1; x++)
+			row[x - x0] = tile.depthMode == TILE_PLANE ? tile.plane.depth(x, y) : clearDepth_;
+	}
+	tile.depthMode = TILE_RAW;
+	return &tile.depth[0];
+}
+
+// raw color of a tile, rows tileSize * bytespp apart; without keep the caller overwrites every pixel
+// and the old contents are not expanded
+unsigned char* TileBuffer::pixels(int tx, int ty, bool keep) {
+	Tile& tile = this->tile(tx, ty);
+	tile.changed = true;
+	if (tile.colorMode == TILE_RAW) return &tile.pixels[0];
+	if (tile.pixels.empty() && !sparePixels_.empty()) {
+		tile.pixels.swap(sparePixels_.back());
+		sparePixels_.pop_back();
+	}
+	tile.pixels.resize(tileSize_ * tileSize_ * bytespp_);
+	if (keep) {
+		if (tile.colorMode == TILE_CLEAR) {
+			std::fill(tile.pixels.begin(), tile.pixels.end(), 0);
+		} else {
+			for (int i = 0; i < tileSize_ * tileSize_; i++)
+				memcpy(&tile.pixels[i * bytespp_], tile.color.raw, bytespp_);
+		}
+	}
+	tile.colorMode = TILE_RAW;
+	return &tile.pixels[0];
+}
+
+// the whole tile is under one triangle: its depth becomes the triangle's plane
+void TileBuffer::set_plane(int tx, int ty, const DepthPlane& plane) {
+	Tile& tile = this->tile(tx, ty);
+	tile.depthMode = TILE_PLANE;
+	tile.plane = plane;
+	release_depth(tile);
+}
+
+// every pixel of the tile has the same color
+void TileBuffer::set_color(int tx, int ty, TGAColor color) {
+	Tile& tile = this->tile(tx, ty);
+	tile.changed = true;
+	tile.colorMode = TILE_CONSTANT;
+	tile.color = color;
+	release_pixels(tile);
+}
+
+// raw storage a tile no longer needs goes to the spares for whichever tile needs it next; the spare lists
+// have room for the storage of every tile, so this never allocates
+void TileBuffer::release_pixels(Tile& tile) {
+	if (!tile.pixels.empty()) {
+		sparePixels_.push_back(std::vector<unsigned char>());
+		sparePixels_.back().swap(tile.pixels);
+	}
+}
+
+void TileBuffer::release_depth(Tile& tile) {
+	if (!tile.depth.empty()) {
+		spareDepth_.push_back(std::vector<float>());
+		spareDepth_.back().swap(tile.depth);
+	}
+}
+
+void TileBuffer::clear_tile(Tile& tile) {
+	if (tile.colorMode != TILE_CLEAR) tile.changed = true;
+	tile.colorMode = tile.depthMode = TILE_CLEAR;
+	release_pixels(tile);
+	release_depth(tile);
+}
+
+void TileBuffer::clear() {
+	for (int i = 0; i < (int)tiles_.size(); i++)
+		clear_tile(tiles_[i]);
+}
+
+// dirty tiles have to line up with ours
+void TileBuffer::clear(const DirtyTiles& dirty) {
+	for (int ty = 0; ty < tilesY_; ty++)
+		for (int tx = 0; tx < tilesX_; tx++)
+			if (dirty.test(tx * tileSize_, ty * tileSize_))
+				clear_tile(tile(tx, ty));
+}
+
+// writes the tiles whose color changed since the last resolve into frame, the others are assumed to still
+// be there; when given, changed gets those tiles marked so that encoders can skip the rest as well
+void TileBuffer::resolve(TGAImage& frame, DirtyTiles* changed) {
+	unsigned char* data = frame.buffer();
+	for (int ty = 0; ty < tilesY_; ty++) {
+		for (int tx = 0; tx < tilesX_; tx++) {
+			Tile& tile = this->tile(tx, ty);
+			if (!tile.changed) continue;
+			tile.changed = false;
+			int x0, y0, x1, y1;
+			rect(tx, ty, x0, y0, x1, y1);
+			if (changed) changed->mark(x0, y0, x1 - 1, y1 - 1);
+			for (int y = y0; y < y1; y++) {
+				unsigned char* row = data + (x0 + y * width_) * bytespp_;
+				if (tile.colorMode == TILE_CLEAR) {
+					memset(row, 0, (x1 - x0) * bytespp_);
+				} else if (tile.colorMode == TILE_CONSTANT) {
+					for (int x = x0; x < x1; x++)
+						memcpy(row + (x - x0) * bytespp_, tile.color.raw, bytespp_);
+				} else {
+					memcpy(row, &tile.pixels[(y - y0) * tileSize_ * bytespp_], (x1 - x0) * bytespp_);
+				}
+			}
+		}
+	}
+}
+
+int TileBuffer::count_color(Mode mode) const {
+	int n = 0;
+	for (int i = 0; i < (int)tiles_.size(); i++)
+		n += tiles_[i].colorMode == mode;
+	return n;
+}
+
+int TileBuffer::count_depth(Mode mode) const {
+	int n = 0;
+	for (int i = 0; i < (int)tiles_.size(); i++)
+		n += tiles_[i].depthMode == mode;
+	return n;
+}
+
+// bytes of raw storage, in use or spare, the compressed forms are accounted for in the tiles themselves
+size_t TileBuffer::memory_usage() {
+	size_t bytes = tiles_.capacity() * sizeof(Tile);
+	for (int i = 0; i < (int)tiles_.size(); i++)
+		bytes += tiles_[i].pixels.capacity() + tiles_[i].depth.capacity() * sizeof(float);
+	for (int i = 0; i < (int)sparePixels_.size(); i++)
+		bytes += sparePixels_[i].capacity();
+	for (int i = 0; i < (int)spareDepth_.size(); i++)
+		bytes += spareDepth_[i].capacity() * sizeof(float);
+	return bytes;
+}
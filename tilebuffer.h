@@ -0,0 +1,79 @@
+#ifndef __TILEBUFFER_H__
+#define __TILEBUFFER_H__
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "tiles.h"
+
+// Depth of a triangle as a plane over the samples of its bounding box, z = c + a * column + b * row with
+// column and row counted from the box corner. The rasterizer takes every sample's depth from it, so a tile
+// entirely covered by one triangle keeps just the plane and still gets its depth back exactly
+struct DepthPlane {
+	float a, b, c;
+	Vec2f origin;
+	DepthPlane() : a(0), b(0), c(0) {}
+	DepthPlane(const Vec3f* t, Vec2f corner); // in raster.cpp, next to the rasterizer it has to agree with
+	float at(int column, int row) const { return c + a * column + b * row; }
+	float depth(int x, int y) const; // of the sample landing on pixel x, y
+};
+
+// Color and depth stored as square tiles, each in the cheapest form that still holds its exact contents:
+// cleared tiles are a flag, a tile of one color is that color, a tile under a single triangle keeps that
+// triangle's depth plane. Raw pixels and depth are only touched once a tile needs them, so clearing costs
+// one flag per tile and background tiles never go through memory at all; a tile that collapses to a color
+// or a plane hands its raw storage back. The raw storage of every tile is made up front and passed between
+// tiles through the spare lists, so that frames never allocate. Shading is no faster than into a flat
+// buffer, what the tiles buy is knowing which of them a frame wrote, so only those go into its patch.
+class TileBuffer {
+public:
+	enum Mode {
+		TILE_CLEAR,    // color and depth: the clear value
+		TILE_CONSTANT, // color: a single color
+		TILE_PLANE,    // depth: the plane of a single triangle
+		TILE_RAW       // color and depth: stored per pixel
+	};
+	struct Tile {
+		unsigned char colorMode;
+		unsigned char depthMode;
+		bool changed; // color differs from what the last resolve wrote out
+		TGAColor color;
+		DepthPlane plane;
+		std::vector<unsigned char> pixels;
+		std::vector<float> depth;
+	};
+private:
+	int width_, height_;
+	int bytespp_;
+	float clearDepth_;
+	int tileSize_;
+	int tilesX_, tilesY_;
+	std::vector<Tile> tiles_;
+	// raw storage no tile is using, handed on to the next tiles that need it
+	std::vector<std::vector<unsigned char> > sparePixels_;
+	std::vector<std::vector<float> > spareDepth_;
+	void release_pixels(Tile& tile);
+	void release_depth(Tile& tile);
+	void clear_tile(Tile& tile);
+public:
+	TileBuffer(int width, int height, int bytespp, float clearDepth, int tileSize = 32);
+	int width() const { return width_; }
+	int height() const { return height_; }
+	int bytespp() const { return bytespp_; }
+	float clear_depth() const { return clearDepth_; }
+	int tile_size() const { return tileSize_; }
+	Tile& tile(int tx, int ty) { return tiles_[tx + ty * tilesX_]; }
+	void rect(int tx, int ty, int& x0, int& y0, int& x1, int& y1) const;
+	float* depth(int tx, int ty);
+	unsigned char* pixels(int tx, int ty, bool keep = true);
+	void set_plane(int tx, int ty, const DepthPlane& plane);
+	void set_color(int tx, int ty, TGAColor color);
+	void clear();
+	void clear(const DirtyTiles& dirty);
+	void resolve(TGAImage& frame, DirtyTiles* changed = NULL);
+	int count_color(Mode mode) const;
+	int count_depth(Mode mode) const;
+	size_t memory_usage();
+};
+
+#endif //__TILEBUFFER_H__
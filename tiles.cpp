@@ -0,0 +1,90 @@
+#include <cstring>
+#include <algorithm>
+#include "tiles.h"
+
+DirtyTiles::DirtyTiles(int width, int height, int tileSize) : width_(width), height_(height), tileSize_(tileSize),
+	tilesX_((width + tileSize - 1) / tileSize), tilesY_((height + tileSize - 1) / tileSize), dirty_(tilesX_ * tilesY_, 0) {
+}
+
+// pixel rectangle, both corners inclusive, clipped to the screen
+void DirtyTiles::mark(int x0, int y0, int x1, int y1) {
+	x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+	x1 = std::min(x1, width_ - 1); y1 = std::min(y1, height_ - 1);
+	if (x0 > x1 || y0 > y1) return;
+	for (int ty = y0 / tileSize_; ty <= y1 / tileSize_; ty++)
+		for (int tx = x0 / tileSize_; tx <= x1 / tileSize_; tx++)
+			dirty_[tx + ty * tilesX_] = 1;
+}
+
+void DirtyTiles::mark_all() {
+	std::fill(dirty_.begin(), dirty_.end(), 1);
+}
+
+void DirtyTiles::reset() {
+	std::fill(dirty_.begin(), dirty_.end(), 0);
+}
+
+int DirtyTiles::count() const {
+	return (int)std::count(dirty_.begin(), dirty_.end(), 1);
+}
+
+bool DirtyTiles::all() const {
+	return count() == (int)dirty_.size();
+}
+
+bool DirtyTiles::any(int x0, int y0, int x1, int y1) const {
+	x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+	x1 = std::min(x1, width_ - 1); y1 = std::min(y1, height_ - 1);
+	if (x0 > x1 || y0 > y1) return false;
+	for (int ty = y0 / tileSize_; ty <= y1 / tileSize_; ty++)
+		for (int tx = x0 / tileSize_; tx <= x1 / tileSize_; tx++)
+			if (dirty_[tx + ty * tilesX_]) return true;
+	return false;
+}
+
+// resets color and depth of the dirty tiles only
+template <class T> void DirtyTiles::clear_tiles(TGAImage& frame, T zBuffer[], T clearDepth) {
+	int bytespp = frame.get_bytespp();
+	unsigned char* data = frame.buffer();
+	for (int ty = 0; ty < tilesY_; ty++) {
+		for (int tx = 0; tx < tilesX_; tx++) {
+			if (!dirty_[tx + ty * tilesX_]) continue;
+			int x0 = tx * tileSize_, x1 = std::min(x0 + tileSize_, width_);
+			int y0 = ty * tileSize_, y1 = std::min(y0 + tileSize_, height_);
+			for (int y = y0; y < y1; y++) {
+				memset(data + (x0 + y * width_) * bytespp, 0, (x1 - x0) * bytespp);
+				std::fill(zBuffer + x0 + y * width_, zBuffer + x1 + y * width_, clearDepth);
+			}
+		}
+	}
+}
+
+void DirtyTiles::clear(TGAImage& frame, float zBuffer[], float clearDepth) {
+	clear_tiles(frame, zBuffer, clearDepth);
+}
+
+void DirtyTiles::clear(TGAImage& frame, int zBuffer[], int clearDepth) {
+	clear_tiles(frame, zBuffer, clearDepth);
+}
+
+// Appends the dirty tiles of the frame to a patch stream: a header of frame index and tile count,
+// then per tile its x and y in tiles followed by the raw rows of its pixels. Applying the patches of
+// all frames in order to a black image reproduces the frame.
+bool DirtyTiles::write_patch(std::ofstream& out, TGAImage& frame, int frameIndex) {
+	int bytespp = frame.get_bytespp();
+	unsigned char* data = frame.buffer();
+	int header[2] = { frameIndex, count() };
+	out.write((char *)header, sizeof(header));
+	for (int ty = 0; ty < tilesY_; ty++) {
+		for (int tx = 0; tx < tilesX_; tx++) {
+			if (!dirty_[tx + ty * tilesX_]) continue;
+			short pos[2] = { (short)tx, (short)ty };
+			out.write((char *)pos, sizeof(pos));
+			int x0 = tx * tileSize_, x1 = std::min(x0 + tileSize_, width_);
+			int y0 = ty * tileSize_, y1 = std::min(y0 + tileSize_, height_);
+			for (int y = y0; y < y1; y++)
+				out.write((char *)(data + (x0 + y * width_) * bytespp), (x1 - x0) * bytespp);
+		}
+	}
+	return out.good();
+}
@@ -0,0 +1,33 @@
+#ifndef __TILES_H__
+#define __TILES_H__
+
+#include <vector>
+#include <fstream>
+#include "tgaimage.h"
+
+// Screen split into square tiles with a dirty flag each. Incremental rendering only clears,
+// rasterizes and re-encodes the tiles flagged here and keeps the rest of the frame as it was.
+class DirtyTiles {
+private:
+	int width_, height_;
+	int tileSize_;
+	int tilesX_, tilesY_;
+	std::vector<unsigned char> dirty_;
+	template <class T> void clear_tiles(TGAImage& frame, T zBuffer[], T clearDepth);
+public:
+	DirtyTiles(int width, int height, int tileSize = 32);
+	void mark(int x0, int y0, int x1, int y1);
+	void mark_all();
+	void reset();
+	int count() const;
+	bool all() const;
+	bool test(int x, int y) const {
+		return dirty_[x / tileSize_ + (y / tileSize_) * tilesX_] != 0;
+	}
+	bool any(int x0, int y0, int x1, int y1) const;
+	void clear(TGAImage& frame, float zBuffer[], float clearDepth);
+	void clear(TGAImage& frame, int zBuffer[], int clearDepth);
+	bool write_patch(std::ofstream& out, TGAImage& frame, int frameIndex);
+};
+
+#endif //__TILES_H__